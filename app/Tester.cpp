@@ -136,7 +136,8 @@ Test::~Test()
 void Test::operator()()
 {
     for (auto i = 0ul; i < _threadNum; ++i) {
-        _threads.emplace_back([this]() {
+        _threads.emplace_back([this, i]() {
+            MultiLogger::setThreadName("tester" + std::to_string(i));
             std::random_device rd;
             std::mt19937 mt{rd()};
             std::uniform_real_distribution<double> readDist{1.0, 10.0};
@@ -4,65 +4,1675 @@
 
 #include <vector>
 #include <queue>
+#include <array>
+#include <memory>
+#include <deque>
+#include <cstdint>
 #include <chrono>
 #include <utility>
 #include <mutex>
 #include <sstream>
-#include <iomanip>
 #include <ctime>
 #include <iostream>
 #include <atomic>
 #include <condition_variable>
 #include <algorithm>
+#include <cstring>
+#include <string>
+#include <cstdio>
+#include <clocale>
+#include <locale>
+#include <ios>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <type_traits>
+#include <limits>
+#include <cmath>
+
+#ifdef USING_CPP17
+# include <charconv>
+#endif
+
+#ifdef _WIN32
+/// thread-safe cross-platform gmtime
+struct tm* gmtime_r(const time_t* time_, struct tm* result_)
+{
+    return (0 == gmtime_s(result_, time_)) ? result_ : 0;
+}
+#endif
+
+namespace MultiLogger
+{
+
+#ifndef USING_CPP17
+namespace cpp17
+{
+namespace pmr
+{
+
+memory_resource* new_delete_resource() noexcept
+{
+    struct NewDeleteResource : public memory_resource
+    {
+        void* do_allocate(const size_t bytes_, size_t) override
+        {
+            return ::operator new(bytes_);
+        }
+        void do_deallocate(void* p_, size_t, size_t) override
+        {
+            ::operator delete(p_);
+        }
+        bool do_is_equal(const memory_resource& other_) const noexcept override
+        {
+            return this == &other_;
+        }
+    };
+    static NewDeleteResource resource;
+    return &resource;
+}
+
+/// The subset of std::pmr::polymorphic_allocator used by the Logger.
+template <class T>
+class polymorphic_allocator
+{
+public:
+    using value_type = T;
+
+    polymorphic_allocator() noexcept
+        : _resource{new_delete_resource()}
+    {}
+    polymorphic_allocator(memory_resource* resource_) noexcept
+        : _resource{resource_}
+    {}
+    template <class U>
+    polymorphic_allocator(const polymorphic_allocator<U>& other_) noexcept
+        : _resource{other_.resource()}
+    {}
+
+    T* allocate(const size_t count_)
+    {
+        return static_cast<T*>(_resource->allocate(count_ * sizeof(T), alignof(T)));
+    }
+    void deallocate(T* p_, const size_t count_)
+    {
+        _resource->deallocate(p_, count_ * sizeof(T), alignof(T));
+    }
+
+    memory_resource* resource() const noexcept
+    {
+        return _resource;
+    }
+
+private:
+    memory_resource*    _resource;
+};
+
+template <class T, class U>
+bool operator==(const polymorphic_allocator<T>& lhs_, const polymorphic_allocator<U>& rhs_) noexcept
+{
+    return lhs_.resource() == rhs_.resource() || lhs_.resource()->is_equal(*rhs_.resource());
+}
+
+template <class T, class U>
+bool operator!=(const polymorphic_allocator<T>& lhs_, const polymorphic_allocator<U>& rhs_) noexcept
+{
+    return !(lhs_ == rhs_);
+}
+
+}
+}
+#endif
+
+/// Vector allocating from the memory resource of an engine.
+template <class T>
+using pmr_vector_t = std::vector<T, cpp17::pmr::polymorphic_allocator<T>>;
+
+//=============================================================================
+
+namespace
+{
+
+/// Write the decimal digits of value_ backwards, ending at end_.
+/// @return the first digit
+template <class Unsigned>
+char* decimalDigits(char* end_, Unsigned value_)
+{
+    do {
+        *--end_ = static_cast<char>('0' + (value_ % 10));
+        value_ /= 10;
+    } while (value_ != 0);
+    return end_;
+}
+
+/// @return true if a byte of word_ is a control character, a quote or a
+/// backslash, the bytes JSON strings escape
+bool needsEscaping(const std::uint64_t word_)
+{
+    const auto ones = std::uint64_t{0x0101010101010101};
+    const auto highs = std::uint64_t{0x8080808080808080};
+    const auto hasZero = [ones, highs](const std::uint64_t bytes_) {
+        return (bytes_ - ones) & ~bytes_ & highs;
+    };
+    const auto control = (word_ - 0x20 * ones) & ~word_ & highs;
+    return (control | hasZero(word_ ^ ('"' * ones)) | hasZero(word_ ^ ('\\' * ones))) != 0;
+}
+
+/// Write the bytes escaped for a JSON string. The 8 byte words without a
+/// byte to escape are skipped at once, the other bytes are copied as
+/// they are, so UTF-8 passes unchanged.
+void appendEscaped(std::streambuf& out_, const char* data_, const size_t size_)
+{
+    static const char hex[] = "0123456789abcdef";
+    const auto end = data_ + size_;
+    auto copied = data_;
+    for (auto at = data_; at < end; ) {
+        if (end - at >= 8) {
+            std::uint64_t word;
+            std::memcpy(&word, at, sizeof(word));
+            if (!needsEscaping(word)) {
+                at += sizeof(word);
+                continue;
+            }
+        }
+        const auto c = static_cast<unsigned char>(*at);
+        if ((c < 0x20) || (c == '"') || (c == '\\')) {
+            out_.sputn(copied, at - copied);
+            char escaped[] = {'\\', static_cast<char>(c), '0', '0', hex[c >> 4], hex[c & 0xf]};
+            auto size = size_t{2};
+            switch (c) {
+                case '"': case '\\': break;
+                case '\b': escaped[1] = 'b'; break;
+                case '\f': escaped[1] = 'f'; break;
+                case '\n': escaped[1] = 'n'; break;
+                case '\r': escaped[1] = 'r'; break;
+                case '\t': escaped[1] = 't'; break;
+                default: escaped[1] = 'u'; size = sizeof(escaped); break;
+            }
+            out_.sputn(escaped, static_cast<std::streamsize>(size));
+            copied = at + 1;
+        }
+        ++at;
+    }
+    out_.sputn(copied, end - copied);
+}
+
+/// Write the line without its line break as the message of a JSON object.
+void appendJsonMessage(std::streambuf& out_, const char* data_, size_t size_)
+{
+    if ((size_ > 0) && (data_[size_ - 1] == '\n')) {
+        --size_;
+    }
+    out_.sputn("{\"message\":\"", 12);
+    appendEscaped(out_, data_, size_);
+    out_.sputn("\"}\n", 3);
+}
+
+/// Write value_ as a text read back as the same double, the shortest one
+/// where std::to_chars is available.
+/// @return the end of the text
+char* roundTripDouble(char (&chars_)[32], const double value_)
+{
+#if defined(USING_CPP17) && defined(__cpp_lib_to_chars)
+    return std::to_chars(chars_, chars_ + sizeof(chars_), value_).ptr;
+#else
+    const auto size = std::snprintf(chars_, sizeof(chars_), "%.17g", value_);
+    const auto end = chars_ + std::min<size_t>(static_cast<size_t>(std::max(size, 0)), sizeof(chars_) - 1);
+    const auto point = *std::localeconv()->decimal_point;
+    if (point != '.') {
+        std::replace(chars_, end, point, '.');
+    }
+    return end;
+#endif
+}
+
+/**
+ * Formats the numbers of the default, fixed and scientific notations without
+ * padding, sign or base flags with std::to_chars, every other case with the
+ * standard facet. The output is the same either way.
+ * Where std::to_chars is missing the integers are converted digit by digit,
+ * the floating-point numbers by snprintf with the decimal point of the C
+ * locale replaced, so the output never depends on the locales.
+ */
+class NumPut : public std::num_put<char>
+{
+protected:
+    iter_type do_put(iter_type out_, std::ios_base& str_, char_type fill_, long value_) const override
+    {
+        return putInteger(out_, str_, fill_, value_);
+    }
+
+    iter_type do_put(iter_type out_, std::ios_base& str_, char_type fill_, unsigned long value_) const override
+    {
+        return putInteger(out_, str_, fill_, value_);
+    }
+
+    iter_type do_put(iter_type out_, std::ios_base& str_, char_type fill_, long long value_) const override
+    {
+        return putInteger(out_, str_, fill_, value_);
+    }
+
+    iter_type do_put(iter_type out_, std::ios_base& str_, char_type fill_, unsigned long long value_) const override
+    {
+        return putInteger(out_, str_, fill_, value_);
+    }
+
+    iter_type do_put(iter_type out_, std::ios_base& str_, char_type fill_, double value_) const override
+    {
+        const auto flags = str_.flags();
+        const auto floatField = flags & std::ios_base::floatfield;
+        if ((str_.width() != 0)
+            || (str_.precision() < 0)
+            || (floatField == std::ios_base::floatfield)
+            || (flags & (std::ios_base::showpos | std::ios_base::showpoint | std::ios_base::uppercase))) {
+            return std::num_put<char>::do_put(out_, str_, fill_, value_);
+        }
+        char chars[128];
+#if defined(USING_CPP17) && defined(__cpp_lib_to_chars)
+        const auto format = (floatField == std::ios_base::fixed) ? std::chars_format::fixed
+            : (floatField == std::ios_base::scientific) ? std::chars_format::scientific
+            : std::chars_format::general;
+        const auto result = std::to_chars(chars, chars + sizeof(chars), value_, format, static_cast<int>(str_.precision()));
+        if (result.ec != std::errc{}) {
+            return std::num_put<char>::do_put(out_, str_, fill_, value_);
+        }
+        return std::copy(chars, result.ptr, out_);
+#else
+        const auto format = (floatField == std::ios_base::fixed) ? "%.*f"
+            : (floatField == std::ios_base::scientific) ? "%.*e"
+            : "%.*g";
+        const auto size = std::snprintf(chars, sizeof(chars), format, static_cast<int>(str_.precision()), value_);
+        if ((size < 0) || (static_cast<size_t>(size) >= sizeof(chars))) {
+            return std::num_put<char>::do_put(out_, str_, fill_, value_);
+        }
+        const auto point = *std::localeconv()->decimal_point;
+        if (point != '.') {
+            std::replace(chars, chars + size, point, '.');
+        }
+        return std::copy(chars, chars + size, out_);
+#endif
+    }
+
+private:
+    template <class Integer>
+    iter_type putInteger(iter_type out_, std::ios_base& str_, char_type fill_, const Integer value_) const
+    {
+        if ((str_.width() != 0)
+            || (str_.flags() & (std::ios_base::showpos | std::ios_base::oct | std::ios_base::hex))) {
+            return std::num_put<char>::do_put(out_, str_, fill_, value_);
+        }
+        char chars[24];
+#ifdef USING_CPP17
+        const auto end = std::to_chars(chars, chars + sizeof(chars), value_).ptr;
+        return std::copy(chars, end, out_);
+#else
+        using unsigned_t = typename std::make_unsigned<Integer>::type;
+        const auto negative = (value_ < 0);
+        const auto magnitude = negative ? (unsigned_t{0} - static_cast<unsigned_t>(value_)) : static_cast<unsigned_t>(value_);
+        auto begin = decimalDigits(chars + sizeof(chars), magnitude);
+        if (negative) {
+            *--begin = '-';
+        }
+        return std::copy(begin, chars + sizeof(chars), out_);
+#endif
+    }
+};
+
+}
+
+namespace imp
+{
+
+const std::locale& numericLocale()
+{
+    static const std::locale locale{std::locale::classic(), new NumPut};
+    return locale;
+}
+
+int fieldsIndex()
+{
+    static const int index = std::ios_base::xalloc();
+    return index;
+}
+
+/// An interned snapshot of the context of a thread, see ScopedContext.
+/// The ContextRegistry deletes it with its last reference.
+struct Context
+{
+    /// The encoded fields of the enclosing contexts followed by its own ones.
+    const std::string                   _fields;
+    /// Unique for the life of the process, unlike the address.
+    const std::uint64_t                 _id;
+    mutable std::atomic<std::uint32_t>  _refs;
+};
+
+}
+
+//=============================================================================
+
+bool LogSite::admit(const RateLimit& loggerLimit_)
+{
+    const auto& limit = _own ? _limit : loggerLimit_;
+    if (limit.unlimited()) {
+        return true;
+    }
+
+    auto passed = true;
+    if (limit._everyNth > 1 || limit._probability < 1.0) {
+        const auto calls = _calls.fetch_add(1, std::memory_order_relaxed);
+        if (limit._everyNth > 1 && calls % limit._everyNth != 0) {
+            passed = false;
+        } else if (limit._probability < 1.0) {
+            // splitmix64 of the call counter: a cheap, well distributed
+            // pseudo random number without any shared generator state
+            auto z = calls + 0x9e3779b97f4a7c15ull;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            z ^= z >> 31;
+            passed = static_cast<double>(z >> 11) < limit._probability * static_cast<double>(1ull << 53);
+        }
+    }
+    if (passed && limit._perSecond > 0) {
+        // generic cell rate algorithm: a token bucket in a single atomic
+        const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        const auto interval = static_cast<std::int64_t>(1000 * 1000 * 1000) / limit._perSecond;
+        const auto tolerance = interval * ((limit._burst > 1) ? (limit._burst - 1) : 0);
+        auto next = _nextTime.load(std::memory_order_relaxed);
+        do {
+            const auto base = (next < now) ? now : next;
+            if (base - now > tolerance) {
+                passed = false;
+                break;
+            }
+            if (_nextTime.compare_exchange_weak(next, base + interval, std::memory_order_relaxed)) {
+                break;
+            }
+        } while (true);
+    }
+    if (!passed) {
+        _suppressed.fetch_add(1, std::memory_order_relaxed);
+    }
+    return passed;
+}
+
+//=============================================================================
+
+size_t LatencyHistogram::bucketOf(const std::uint64_t nanos_)
+{
+    if (nanos_ < 2 * subBuckets) {
+        return static_cast<size_t>(nanos_);
+    }
+    // floor(log2(nanos_)) by binary search, at least 4 here
+    auto exp = size_t{0};
+    for (auto shift = size_t{32}; shift > 0; shift /= 2) {
+        if ((nanos_ >> (exp + shift)) != 0) {
+            exp += shift;
+        }
+    }
+    return 2 * subBuckets + (exp - 4) * subBuckets + static_cast<size_t>((nanos_ >> (exp - 3)) & (subBuckets - 1));
+}
+
+std::uint64_t LatencyHistogram::highestOf(const size_t bucket_)
+{
+    if (bucket_ < 2 * subBuckets) {
+        return bucket_;
+    }
+    const auto exp = (bucket_ - 2 * subBuckets) / subBuckets + 4;
+    const auto sub = static_cast<std::uint64_t>((bucket_ - 2 * subBuckets) % subBuckets);
+    const auto width = std::uint64_t{1} << (exp - 3);
+    return (subBuckets + sub) * width + width - 1;
+}
+
+std::uint64_t LatencyHistogram::percentile(const double fraction_) const
+{
+    if (_count == 0) {
+        return 0;
+    }
+    auto rank = static_cast<std::uint64_t>(fraction_ * static_cast<double>(_count) + 0.5);
+    rank = std::max<std::uint64_t>(1, std::min(rank, _count));
+    auto seen = std::uint64_t{0};
+    for (auto i = size_t{0}; i < buckets; ++i) {
+        seen += _counts[i];
+        if (!(seen < rank)) {
+            return std::min(highestOf(i), _max);
+        }
+    }
+    return _max;
+}
+
+//=============================================================================
+
+namespace
+{
+
+/// Hash of a message payload used to detect duplicates. The 32 byte blocks
+/// are mixed in four independent lanes so the loop can be vectorized.
+std::uint64_t hashBytes(const char* data_, const size_t size_)
+{
+    const std::uint64_t prime = 0x9e3779b97f4a7c15ull;
+    std::uint64_t lanes[4] = {prime, prime ^ size_, ~prime, ~prime ^ size_};
+    auto i = size_t{0};
+    for (; i + sizeof(lanes) <= size_; i += sizeof(lanes)) {
+        std::uint64_t block[4];
+        std::memcpy(block, data_ + i, sizeof(block));
+        for (auto l = 0; l < 4; ++l) {
+            lanes[l] = (lanes[l] ^ block[l]) * prime;
+            lanes[l] ^= lanes[l] >> 29;
+        }
+    }
+    auto hash = lanes[0] ^ (lanes[1] * 3) ^ (lanes[2] * 5) ^ (lanes[3] * 7);
+    for (; i < size_; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(data_[i])) * prime;
+    }
+    return hash ^ (hash >> 32);
+}
+
+}
+
+using time_point_t = std::chrono::system_clock::time_point;
+
+/// Collapses consecutive duplicates written to a destination into one line and
+/// a "last message repeated N times" summary. Only the backend touches it.
+/// The summary is a message of its own, with the priority, the call site
+/// and the thread of the repeated message, rendered in the layout of the
+/// destination.
+struct Dedup
+{
+    explicit Dedup(const std::chrono::nanoseconds window_)
+        : _window{window_}
+    {}
+
+    /// @return true if the message repeats the previous one within the window
+    bool repeats(const char* file_, const int line_, const std::uint64_t hash_, const time_point_t time_)
+    {
+        if (hash_ == _hash && line_ == _line && file_ == _file && !(_first + _window < time_)) {
+            ++_repeated;
+            return true;
+        }
+        return false;
+    }
+
+    void reset(const char* file_, const int line_, const std::uint64_t hash_, const time_point_t time_)
+    {
+        _file = file_;
+        _line = line_;
+        _hash = hash_;
+        _first = time_;
+        _repeated = 0;
+    }
+
+    /// Keep what the summary of the repeats of the message shows.
+    void remember(const Priority priority_, const char* function_, const std::uint16_t thread_
+        , const std::string* threadText_)
+    {
+        _priority = priority_;
+        _function = function_;
+        _thread = thread_;
+        _threadText = threadText_;
+    }
+
+    const std::chrono::nanoseconds  _window;
+    const char*                     _file{nullptr};
+    int                             _line{0};
+    Priority                        _priority{Priority::Info};
+    const char*                     _function{nullptr};
+    std::uint16_t                   _thread{0};
+    const std::string*              _threadText{nullptr};
+    std::uint64_t                   _hash{0};
+    time_point_t                    _first;
+    size_t                          _repeated{0};
+};
+
+//=============================================================================
+
+const char* const Layout::classic = "%d %t %c %f %p: %m (%F:%L)";
+const char* const Layout::json = "%j";
+
+Layout::Layout(const std::string& pattern_)
+    : _pattern{pattern_}
+    , _classic{pattern_ == classic}
+{
+    const auto field = [this](const Field field_) {
+        _ops.push_back(Op{field_, 0, 0});
+    };
+    const auto literal = [this](const char c_) {
+        if (_ops.empty() || _ops.back()._field != Field::Literal) {
+            _ops.push_back(Op{Field::Literal, static_cast<std::uint32_t>(_literals.size()), 0});
+        }
+        _literals.push_back(c_);
+        ++_ops.back()._size;
+    };
+    for (auto i = size_t{0}; i < pattern_.size(); ++i) {
+        if (pattern_[i] != '%') {
+            literal(pattern_[i]);
+            continue;
+        }
+        if (++i == pattern_.size()) {
+            throw std::runtime_error("the layout pattern ends with %: " + pattern_);
+        }
+        switch (pattern_[i]) {
+            case 'd': field(Field::Time); break;
+            case 't': field(Field::Thread); break;
+            case 'c': field(Field::Category); break;
+            case 'f': field(Field::Function); break;
+            case 'p': field(Field::Priority); break;
+            case 'm': field(Field::Message); break;
+            case 'F': field(Field::File); break;
+            case 'L': field(Field::Line); break;
+            case 'j': field(Field::Json); break;
+            case '%': literal('%'); break;
+            default: throw std::runtime_error(std::string{"unknown layout field %"} + pattern_[i] + " in " + pattern_);
+        }
+    }
+}
+
+namespace
+{
+
+/// @return the compiled layout of pattern_, shared by the same patterns
+std::shared_ptr<const Layout> layoutOf(const std::string& pattern_)
+{
+    static std::mutex mutex;
+    static std::map<std::string, std::weak_ptr<const Layout>> layouts;
+    std::lock_guard<std::mutex> lg{mutex};
+    const auto found = layouts.find(pattern_);
+    if (found != layouts.end()) {
+        if (auto layout = found->second.lock()) {
+            return layout;
+        }
+    }
+    auto layout = std::make_shared<const Layout>(pattern_);
+    layouts[pattern_] = layout;
+    return layout;
+}
+
+}
+
+//=============================================================================
+
+/// Wrapper class with meaningful member variables.
+/// Used instead of a std::tuple for readability.
+struct LogTarget
+{
+    LogTarget(const std::string& name_
+        , const LogDest::shared_ptr_t& dest_
+        , const Priority threshold_
+        , const bool enabled_
+        , const std::shared_ptr<const Layout>& layout_
+        , const bool jsonMessage_)
+        : _name{name_}
+        , _dest{dest_}
+        , _threshold{threshold_}
+        , _enabled{enabled_}
+        , _layout{layout_}
+        , _jsonMessage{jsonMessage_}
+    {}
+    ~LogTarget()
+    {}
+
+    LogTarget(const LogTarget&) = default;
+    LogTarget& operator=(const LogTarget&) = delete;
+    LogTarget(LogTarget&&) = default;
+    LogTarget& operator=(LogTarget&&) = delete;
+
+    const std::string       _name;
+    /// Shared between the snapshots of the destination list
+    /// and possibly with other Loggers.
+    LogDest::shared_ptr_t   _dest;
+    Priority                _threshold;
+    bool                    _enabled;
+    /// Shared between the snapshots of the destination list, nullptr if disabled.
+    std::shared_ptr<Dedup>  _dedup;
+    /// The layout of the destination when it was added.
+    std::shared_ptr<const Layout>   _layout;
+    /// The destination takes only JSON objects but the layout renders
+    /// something else, its lines are written as the message of an object.
+    bool                            _jsonMessage;
+};
+
+using dests_t = std::vector<LogTarget>;
+/// A destination in a route, its deduplication state if enabled and its layout.
+struct RouteEntry
+{
+    LogDest*                _dest;
+    Dedup*                  _dedup;
+    const Layout*           _layout;
+    /// See LogTarget::_jsonMessage.
+    bool                    _jsonMessage;
+    /// The index of the layout among the layouts of the DestSet. The
+    /// destinations of the same group share the rendered line.
+    size_t                  _group;
+};
+/// The destinations which write a message of a given priority.
+using route_t = std::vector<RouteEntry>;
+using routes_t = std::array<route_t, static_cast<size_t>(Priority::__Size)>;
+
+/// An immutable snapshot of the destinations and their routing table.
+/// Every reconfiguration publishes a new one; the old one is freed when
+/// its last reader, usually the backend, releases it.
+struct DestSet
+{
+    dests_t                 _targets;
+    routes_t                _routes;
+    /// The number of different layouts in the routes.
+    size_t                  _groups{0};
+    /// The lowest priority written by at least one destination.
+    Priority                _floor{Priority::__Size};
+};
+using dest_set_ptr_t = std::shared_ptr<const DestSet>;
+
+/// LatencyHistogram with a single writer, the backend of the engine.
+/// Readers may load the counters any time.
+struct LatencyRecorder
+{
+    void record(const std::uint64_t nanos_)
+    {
+        auto& counter = _counts[LatencyHistogram::bucketOf(nanos_)];
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (_max.load(std::memory_order_relaxed) < nanos_) {
+            _max.store(nanos_, std::memory_order_relaxed);
+        }
+    }
+
+    LatencyHistogram snapshot() const
+    {
+        LatencyHistogram histogram;
+        histogram._count = 0;
+        for (auto i = size_t{0}; i < LatencyHistogram::buckets; ++i) {
+            histogram._counts[i] = _counts[i].load(std::memory_order_relaxed);
+            histogram._count += histogram._counts[i];
+        }
+        histogram._max = _max.load(std::memory_order_relaxed);
+        return histogram;
+    }
+
+    std::array<std::atomic<std::uint64_t>, LatencyHistogram::buckets>  _counts{};
+    std::atomic<std::uint64_t>                                          _max{0};
+};
+
+/// The parts of the lines of a Logger which only depend on its category,
+/// rendered when the category is set. Setting another one replaces the header.
+struct LineHeader
+{
+    explicit LineHeader(const std::string& category_)
+        : _category{category_}
+        , _classic{" " + category_ + " "}
+        , _json{json(category_)}
+    {}
+
+    /// The category as %c shows it.
+    const std::string   _category;
+    /// The category with its separators in Layout::classic.
+    const std::string   _classic;
+    /// The escaped category with the keys around it in Layout::json.
+    const std::string   _json;
+
+private:
+    static std::string json(const std::string& category_)
+    {
+        std::stringbuf out;
+        out.sputn("\",\"category\":\"", 14);
+        appendEscaped(out, category_.data(), category_.size());
+        out.sputn("\",\"thread\":\"", 12);
+        return out.str();
+    }
+};
+
+/// The part of a Logger which the engine reads while writing its messages.
+/// The first two members are immutable snapshots replaced with atomic stores.
+struct LogSource
+{
+    std::shared_ptr<const LineHeader>   _header;
+    dest_set_ptr_t                      _dests;
+    /// Time from logging until handing over to the destinations.
+    mutable LatencyRecorder             _latency;
+    /// The targets whose Dedup a reconfiguration dropped, the backend
+    /// writes their pending summaries. Filled together with storing the
+    /// snapshot without them, so the backend takes the targets and loads
+    /// the new snapshot together, and never uses a Dedup it summarized.
+    mutable std::mutex                  _retiredMutex;
+    mutable dests_t                     _retired;
+    mutable std::atomic<bool>           _retiring{false};
+};
+
+using epoch_t = std::uint64_t;
+
+//=============================================================================
+
+class BlockPool;
+
+/**
+ * A fixed size piece of memory the texts of the queued messages are copied
+ * into. The block itself is the header, the texts follow it.
+ * 
+ * A producer thread takes a block from the pool and allocates from it
+ * until it is full. Every message in it holds a reference which the
+ * backend drops after writing the message. The producer holds a bias
+ * instead of a reference per message, so allocating needs no atomic
+ * operation. The block returns to the pool with its last reference.
+ * The blocks are allocated from the memory resource of the engine and
+ * freed together with it.
+ */
+struct Block
+{
+    static const size_t size = 64 * 1024;
+    static const std::uint32_t bias = 1u << 30;
+
+    explicit Block(BlockPool& pool_)
+        : _pool{pool_}
+    {}
+
+    static size_t capacity()
+    {
+        return size - sizeof(Block);
+    }
+
+    char* data()
+    {
+        return reinterpret_cast<char*>(this + 1);
+    }
+
+    BlockPool&                  _pool;
+    std::atomic<std::uint32_t>  _refs{0};
+    /// The next free block in the pool.
+    Block*                      _next{nullptr};
+    /// The next block in the list of every block of the pool.
+    Block*                      _nextAll{nullptr};
+};
+
+/**
+ * The blocks of an engine, allocated on demand and reused forever.
+ * 
+ * The free blocks are kept in a lock-free stack. Taking a block empties
+ * the whole stack with one exchange and pushes back the rest, so the
+ * stack never suffers from the ABA problem of popping a single node.
+ * 
+ * The engine closes the pool when it is destroyed which frees every block,
+ * even the ones the threads still use. The threads find the pool closed
+ * and forget their block.
+ */
+class BlockPool
+{
+public:
+    explicit BlockPool(cpp17::pmr::memory_resource* resource_)
+        : _resource{resource_}
+    {}
+    ~BlockPool()
+    {
+        close();
+    }
+
+    /// Free every block.
+    /// @pre the engine does not use the pool anymore
+    void close()
+    {
+        std::lock_guard<std::mutex> lg{_closeMutex};
+        _closed = true;
+        _free = nullptr;
+        auto block = _all.exchange(nullptr);
+        while (block) {
+            const auto next = block->_nextAll;
+            block->~Block();
+            _resource->deallocate(block, Block::size, alignof(Block));
+            block = next;
+        }
+    }
+
+    /// Let a thread drop its references of a block if the pool is still open.
+    void detach(Block* block_, const std::uint32_t count_)
+    {
+        std::lock_guard<std::mutex> lg{_closeMutex};
+        if (!_closed) {
+            release(block_, count_);
+        }
+    }
+
+    /// @return a free block with the bias of its producer
+    Block* acquire()
+    {
+        auto block = _free.exchange(nullptr, std::memory_order_acquire);
+        if (block) {
+            if (block->_next) {
+                auto last = block->_next;
+                while (last->_next) {
+                    last = last->_next;
+                }
+                push(block->_next, last);
+            }
+        } else {
+            block = new (_resource->allocate(Block::size, alignof(Block))) Block{*this};
+            _reserved.fetch_add(Block::size, std::memory_order_relaxed);
+            block->_nextAll = _all.load(std::memory_order_relaxed);
+            while (!_all.compare_exchange_weak(block->_nextAll, block, std::memory_order_release, std::memory_order_relaxed)) {
+            }
+        }
+        block->_next = nullptr;
+        block->_refs.store(Block::bias, std::memory_order_relaxed);
+        return block;
+    }
+
+    /// Drop count_ references of the block, the last one returns it to the pool.
+    static void release(Block* block_, const std::uint32_t count_)
+    {
+        if (block_->_refs.fetch_sub(count_, std::memory_order_acq_rel) == count_) {
+            block_->_pool.push(block_, block_);
+        }
+    }
+
+    /// @return the memory held by the pool
+    std::uint64_t reserved() const
+    {
+        return _reserved.load(std::memory_order_relaxed);
+    }
+
+    BlockPool(const BlockPool&) = delete;
+    BlockPool& operator=(const BlockPool&) = delete;
+    BlockPool(BlockPool&&) = delete;
+    BlockPool& operator=(BlockPool&&) = delete;
+
+private:
+    /// Push the blocks from first_ to last_ linked by their _next pointers.
+    void push(Block* first_, Block* last_)
+    {
+        auto head = _free.load(std::memory_order_relaxed);
+        do {
+            last_->_next = head;
+        } while (!_free.compare_exchange_weak(head, first_, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    cpp17::pmr::memory_resource*    _resource;
+    std::atomic<Block*>             _free{nullptr};
+    /// Every block, only pushed until the pool is closed.
+    std::atomic<Block*>             _all{nullptr};
+    std::atomic<std::uint64_t>      _reserved{0};
+    std::mutex                      _closeMutex;
+    bool                            _closed{false};
+};
+
+/**
+ * The block a thread currently copies its messages into.
+ * 
+ * A thread has one block at a time, so threads logging through many engines
+ * in turns hand back partially used blocks. The pool is kept alive until the
+ * block is handed back.
+ */
+struct ThreadArena
+{
+    ~ThreadArena()
+    {
+        detach();
+    }
+
+    /// @return size_ bytes in the current block of the thread, nullptr if
+    ///         the text is too large for the blocks
+    char* allocate(const std::shared_ptr<BlockPool>& pool_, const size_t size_, Block*& block_)
+    {
+        if (size_ > Block::capacity() / 4) {
+            return nullptr;
+        }
+        if (_pool != pool_ || _used + size_ > Block::capacity() || _allocated + 1 == Block::bias) {
+            detach();
+            _pool = pool_;
+            _block = _pool->acquire();
+        }
+        const auto text = _block->data() + _used;
+        _used += size_;
+        ++_allocated;
+        block_ = _block;
+        return text;
+    }
+
+    void detach()
+    {
+        if (_block) {
+            _pool->detach(_block, Block::bias - _allocated);
+        }
+        _block = nullptr;
+        _used = 0;
+        _allocated = 0;
+        _pool.reset();
+    }
+
+    std::shared_ptr<BlockPool>      _pool;
+    Block*                          _block{nullptr};
+    size_t                          _used{0};
+    std::uint32_t                   _allocated{0};
+};
+
+/**
+ * Stream buffer of the formatted lines of a batch which keeps its memory
+ * between the batches, unlike std::ostringstream.
+ */
+class BatchBuffer : public std::streambuf
+{
+public:
+    explicit BatchBuffer(cpp17::pmr::memory_resource* resource_)
+        : _data{cpp17::pmr::polymorphic_allocator<char>{resource_}}
+    {}
+
+    void clear()
+    {
+        _data.clear();
+    }
+
+    /// Give the memory back if a burst grew the buffer beyond retain_.
+    void shrink(const size_t retain_)
+    {
+        if (_data.capacity() > retain_) {
+            pmr_vector_t<char>{_data.get_allocator()}.swap(_data);
+        }
+    }
+
+    const char* data() const
+    {
+        return _data.data();
+    }
+
+    size_t size() const
+    {
+        return _data.size();
+    }
+
+protected:
+    int_type overflow(const int_type ch_) override
+    {
+        if (!traits_type::eq_int_type(ch_, traits_type::eof())) {
+            _data.push_back(traits_type::to_char_type(ch_));
+        }
+        return traits_type::not_eof(ch_);
+    }
+
+    std::streamsize xsputn(const char* data_, const std::streamsize size_) override
+    {
+        _data.insert(_data.end(), data_, data_ + size_);
+        return size_;
+    }
+
+private:
+    pmr_vector_t<char>              _data;
+};
+
+/**
+ * Gives every logging thread a small index and the text its log lines show:
+ * the name set by setThreadName(), or the index.
+ * The index of a finished thread is reused by a later one, the oldest first.
+ * The messages take the text of their thread when they are logged, so
+ * neither a reused index nor a new name changes the lines of the messages
+ * still queued. For that the texts are interned and never freed, the
+ * registry keeps one per index and one per distinct name.
+ */
+class ThreadRegistry
+{
+public:
+    /// Shared by the threads beyond the first 65535 and by the threads
+    /// which never logged.
+    static const std::uint16_t unknown = 0xffff;
+
+    /// A thread as its messages refer to it.
+    struct Thread
+    {
+        std::uint16_t       _index;
+        const std::string*  _text;
+    };
+
+    static ThreadRegistry& instance()
+    {
+        // never destroyed, threads may exit after the static destructors
+        static auto registry = new ThreadRegistry;
+        return *registry;
+    }
+
+    /// Register the calling thread.
+    Thread acquire(const std::thread::id id_)
+    {
+        std::lock_guard<std::mutex> lg{_mutex};
+        auto index = unknown;
+        if (!_free.empty()) {
+            index = _free.front();
+            _free.pop_front();
+        } else if (_texts.size() < unknown) {
+            index = static_cast<std::uint16_t>(_texts.size());
+            _texts.emplace_back();
+        } else {
+            return Thread{unknown, _unknown};
+        }
+        _texts[index] = intern(std::to_string(index));
+        _ids.emplace(id_, index);
+        return Thread{index, _texts[index]};
+    }
+
+    void release(const std::thread::id id_, const std::uint16_t index_)
+    {
+        std::lock_guard<std::mutex> lg{_mutex};
+        if (index_ != unknown) {
+            _ids.erase(id_);
+            _free.push_back(index_);
+        }
+    }
+
+    /// @return the text of name_ for the thread of index_
+    const std::string* name(const std::uint16_t index_, const std::string& name_)
+    {
+        std::lock_guard<std::mutex> lg{_mutex};
+        const auto text = intern(name_);
+        if (index_ != unknown) {
+            _texts[index_] = text;
+        }
+        return text;
+    }
+
+    /// @return the thread of id_ if it is registered, it is not registered
+    ///         otherwise, since no slot would release it
+    Thread find(const std::thread::id id_) const
+    {
+        std::lock_guard<std::mutex> lg{_mutex};
+        const auto found = _ids.find(id_);
+        return (found == _ids.end()) ? Thread{unknown, _unknown} : Thread{found->second, _texts[found->second]};
+    }
+
+private:
+    ThreadRegistry()
+        : _unknown{intern("?")}
+    {}
+
+    /// @pre _mutex is locked, unless called by the constructor
+    const std::string* intern(const std::string& text_)
+    {
+        return &*_interned.insert(text_).first;
+    }
+
+    mutable std::mutex                                  _mutex;
+    /// The elements of the node based set never move.
+    std::unordered_set<std::string>                     _interned;
+    const std::string* const                            _unknown;
+    std::vector<const std::string*>                     _texts;
+    std::deque<std::uint16_t>                           _free;
+    std::unordered_map<std::thread::id, std::uint16_t>  _ids;
+};
+
+const std::uint16_t ThreadRegistry::unknown;
+
+/// The registration of a thread, released when the thread exits.
+struct ThreadSlot
+{
+    ThreadSlot()
+        : _thread{ThreadRegistry::instance().acquire(std::this_thread::get_id())}
+    {}
+    ~ThreadSlot()
+    {
+        ThreadRegistry::instance().release(std::this_thread::get_id(), _thread._index);
+    }
+
+    /// Its text changes with setThreadName().
+    ThreadRegistry::Thread  _thread;
+};
+
+/// @return the registration of the calling thread
+ThreadSlot& threadSlot()
+{
+    thread_local ThreadSlot slot;
+    return slot;
+}
+
+/// @return the thread of threadId_ with its current text, or
+///         ThreadRegistry::unknown for another thread which never logged
+ThreadRegistry::Thread threadOf(const std::thread::id threadId_)
+{
+    return (threadId_ == std::this_thread::get_id()) ? threadSlot()._thread
+        : ThreadRegistry::instance().find(threadId_);
+}
+
+/**
+ * Interns the contexts of the threads by their fields, so the threads in
+ * the same context share a snapshot. The ScopedContexts and the queued
+ * messages hold references to the snapshots, the last one deletes it.
+ * A snapshot whose last reference is being released is not revived, a new
+ * one replaces it instead.
+ */
+class ContextRegistry
+{
+public:
+    static ContextRegistry& instance()
+    {
+        // never destroyed, threads may exit after the static destructors
+        static auto registry = new ContextRegistry;
+        return *registry;
+    }
+
+    /// @return the context of fields_ with a reference for the caller
+    const imp::Context* acquire(std::string&& fields_)
+    {
+        std::lock_guard<std::mutex> lg{_mutex};
+        auto& context = _contexts[fields_];
+        if (context) {
+            auto refs = context->_refs.load(std::memory_order_relaxed);
+            while (refs != 0) {
+                if (context->_refs.compare_exchange_weak(refs, refs + 1, std::memory_order_relaxed)) {
+                    return context;
+                }
+            }
+        }
+        context = new imp::Context{std::move(fields_), ++_lastId, {1}};
+        return context;
+    }
+
+    static void retain(const imp::Context* context_)
+    {
+        context_->_refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release(const imp::Context* context_)
+    {
+        if (context_->_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            {
+                std::lock_guard<std::mutex> lg{_mutex};
+                const auto found = _contexts.find(context_->_fields);
+                if (found != _contexts.end() && found->second == context_) {
+                    _contexts.erase(found);
+                }
+            }
+            delete context_;
+        }
+    }
 
-#ifdef _WIN32
-/// thread-safe cross-platform gmtime
-struct tm* gmtime_r(const time_t* time_, struct tm* result_)
+private:
+    ContextRegistry() = default;
+
+    std::mutex                                              _mutex;
+    std::unordered_map<std::string, const imp::Context*>    _contexts;
+    std::uint64_t                                           _lastId = 0;
+};
+
+/// The innermost ScopedContext of the calling thread, nullptr outside them.
+const imp::Context*& currentContext()
 {
-    return (0 == gmtime_s(result_, time_)) ? result_ : 0;
+    thread_local const imp::Context* context = nullptr;
+    return context;
 }
-#endif
 
-namespace MultiLogger
+/// @return the context of the calling thread with a reference for a message
+const imp::Context* retainContext()
 {
+    const auto context = currentContext();
+    if (context) {
+        ContextRegistry::retain(context);
+    }
+    return context;
+}
 
-/// Wrapper class with meaningful member variables.
-/// Used instead of a std::tuple for readability.
-struct LogTarget
+//=============================================================================
+
+/// A log message waiting in the queue of the engine.
+struct LogRecord
 {
-    LogTarget(const std::string& name_
-        , LogDest::ptr_t&& dest_
-        , const Priority threshold_
-        , const bool enabled_)
-        : _name{name_}
-        , _dest{std::move(dest_)}
-        , _threshold{threshold_}
-        , _enabled{enabled_}
-    {}
-    ~LogTarget()
-    {}
+    time_point_t            _time;
+    /// Keeps the order of the messages logged at the same time.
+    std::uint64_t           _seq;
+    epoch_t                 _epoch;
+    const LogSource*        _source;
+    Priority                _priority;
+    const char*             _function;
+    const char*             _file;
+    int                     _line;
+    /// The thread and its text when the message was logged.
+    ThreadRegistry::Thread  _thread;
+    /// The text is in _block if the message fit in one, otherwise it is
+    /// allocated separately from the memory resource of the engine.
+    const char*             _text;
+    size_t                  _size;
+    /// The size of the structured fields, encoded after the text.
+    std::uint32_t           _fields;
+    /// A reference to the context of the thread, nullptr without one.
+    const imp::Context*     _context;
+    Block*                  _block;
+    /// Owned, the backend renders the text if set.
+    DeferredText*           _deferred;
+
+    bool operator>(const LogRecord& rhs_) const
+    {
+        return (_time == rhs_._time) ? (_seq > rhs_._seq) : (_time > rhs_._time);
+    }
+};
 
-    LogTarget(const LogTarget&) = delete;
-    LogTarget& operator=(const LogTarget&) = delete;
-    LogTarget(LogTarget&&) = default;
-    LogTarget& operator=(LogTarget&&) = default;
+/// A structured field of a record, decoded from the bytes after its text.
+struct FieldView
+{
+    imp::FieldType          _type;
+    const char*             _key;
+    size_t                  _keySize;
+    const char*             _value;
+    size_t                  _size;
+};
 
-    const std::string       _name;
-    LogDest::ptr_t          _dest;
-    Priority                _threshold;
-    bool                    _enabled;
+/// Call visit_(const FieldView&) with the fields encoded in [begin_, end_) in order.
+template <class Visitor>
+void forEachField(const char* begin_, const char* end_, Visitor&& visit_)
+{
+    for (auto at = begin_; at < end_; ) {
+        FieldView field;
+        field._type = static_cast<imp::FieldType>(at[0]);
+        field._keySize = static_cast<unsigned char>(at[1]);
+        field._key = at + 2;
+        field._value = field._key + field._keySize;
+        if (field._type == imp::FieldType::String) {
+            std::uint32_t size;
+            std::memcpy(&size, field._value, sizeof(size));
+            field._value += sizeof(size);
+            field._size = size;
+        } else {
+            field._size = (field._type == imp::FieldType::Bool) ? sizeof(bool) : 8;
+        }
+        at = field._value + field._size;
+        visit_(field);
+    }
+}
+
+/// Call visit_(const FieldView&) with the structured fields of msg_ in order.
+template <class Visitor>
+void forEachField(const LogRecord& msg_, Visitor&& visit_)
+{
+    forEachField(msg_._text + msg_._size, msg_._text + msg_._size + msg_._fields, std::forward<Visitor>(visit_));
+}
+
+/// Always returns the earliest message as its top element.
+using record_queue_t = std::priority_queue<LogRecord
+    , pmr_vector_t<LogRecord>
+    , std::greater<LogRecord>>;
+
+/**
+ * Assembles the complete log lines of the messages by running the ops of
+ * a Layout, the classic layout has a fixed rendering without the ops. The
+ * constant parts are copied from pre-rendered fragments: the literals of
+ * the Layout, the category fragments of the LineHeader, the labels of the priorities
+ * and the time of the current second. Only the fractions of the second,
+ * the line numbers and the texts are formatted.
+ */
+class LineFormatter
+{
+public:
+    /// @param jsonMessage_ write the line as the message of a JSON object
+    void format(std::streambuf& out_
+        , const LogRecord& msg_
+        , const LineHeader& header_
+        , const std::string& thread_
+        , const Layout& layout_
+        , const bool jsonMessage_ = false)
+    {
+        if (jsonMessage_) {
+            _message.str(std::string{});
+            format(_message, msg_, header_, thread_, layout_);
+            const auto line = _message.str();
+            appendJsonMessage(out_, line.data(), line.size());
+        } else if (layout_.isClassic()) {
+            formatClassic(out_, msg_, header_, thread_);
+        } else {
+            formatOps(out_, msg_, header_, thread_, layout_);
+        }
+    }
+
+private:
+    /// Run the ops of the layout.
+    void formatOps(std::streambuf& out_
+        , const LogRecord& msg_
+        , const LineHeader& header_
+        , const std::string& thread_
+        , const Layout& layout_)
+    {
+        const auto literals = layout_.literals().data();
+        for (const auto& op : layout_.ops()) {
+            switch (op._field) {
+                case Layout::Field::Literal:
+                    if (op._size == 1) {
+                        out_.sputc(literals[op._begin]);
+                    } else {
+                        append(out_, literals + op._begin, op._size);
+                    }
+                    break;
+                case Layout::Field::Time:
+                    appendTime(out_, msg_._time);
+                    break;
+                case Layout::Field::Thread:
+                    append(out_, thread_.data(), thread_.size());
+                    break;
+                case Layout::Field::Category:
+                    append(out_, header_._category.data(), header_._category.size());
+                    break;
+                case Layout::Field::Function:
+                    append(out_, msg_._function, std::strlen(msg_._function));
+                    break;
+                case Layout::Field::Priority: {
+                    const auto& label = labels()[static_cast<size_t>(msg_._priority)];
+                    append(out_, label._data, label._size);
+                    break;
+                }
+                case Layout::Field::Message:
+                    appendMessage(out_, msg_);
+                    break;
+                case Layout::Field::File:
+                    append(out_, msg_._file, std::strlen(msg_._file));
+                    break;
+                case Layout::Field::Line:
+                    appendNumber(out_, msg_._line);
+                    break;
+                case Layout::Field::Json:
+                    appendJson(out_, msg_, header_, thread_);
+                    break;
+            }
+        }
+        out_.sputc('\n');
+    }
+
+    /// The classic layout without running its ops.
+    void formatClassic(std::streambuf& out_
+        , const LogRecord& msg_
+        , const LineHeader& header_
+        , const std::string& thread_)
+    {
+        const auto& label = labels()[static_cast<size_t>(msg_._priority)];
+        appendTime(out_, msg_._time);
+        out_.sputc(' ');
+        append(out_, thread_.data(), thread_.size());
+        append(out_, header_._classic.data(), header_._classic.size());
+        append(out_, msg_._function, std::strlen(msg_._function));
+        out_.sputc(' ');
+        append(out_, label._data, label._size);
+        append(out_, ": ", 2);
+        appendMessage(out_, msg_);
+        append(out_, " (", 2);
+        append(out_, msg_._file, std::strlen(msg_._file));
+        out_.sputc(':');
+        appendNumber(out_, msg_._line);
+        append(out_, ")\n", 2);
+    }
+
+    /// The names of the priorities.
+    static const std::array<LogLine, static_cast<size_t>(Priority::__Size)>& labels()
+    {
+        static const std::array<LogLine, static_cast<size_t>(Priority::__Size)> labels{{
+            {"Debug", 5}
+            , {"Info", 4}
+            , {"Warning", 7}
+            , {"Error", 5}
+            , {"Critical", 8}
+        }};
+        return labels;
+    }
+
+    static void append(std::streambuf& out_, const char* data_, const size_t size_)
+    {
+        out_.sputn(data_, static_cast<std::streamsize>(size_));
+    }
+
+    template <size_t N>
+    static void appendLiteral(std::streambuf& out_, const char (&literal_)[N])
+    {
+        append(out_, literal_, N - 1);
+    }
+
+    static void appendNumber(std::streambuf& out_, const std::int64_t value_)
+    {
+        char chars[24];
+        const auto end = chars + sizeof(chars);
+        auto begin = decimalDigits(end, (value_ < 0) ? (0 - static_cast<std::uint64_t>(value_)) : static_cast<std::uint64_t>(value_));
+        if (value_ < 0) {
+            *--begin = '-';
+        }
+        append(out_, begin, static_cast<size_t>(end - begin));
+    }
+
+    /// The text of the message followed by the fields of its context and
+    /// its structured fields as key=value.
+    void appendMessage(std::streambuf& out_, const LogRecord& msg_)
+    {
+        append(out_, msg_._text, msg_._size);
+        if (msg_._context) {
+            const auto& text = context(msg_)._text;
+            append(out_, text.data(), text.size());
+        }
+        if (msg_._fields != 0) {
+            forEachField(msg_, [&out_](const FieldView& field_) {
+                appendTextField(out_, field_);
+            });
+        }
+    }
+
+    static void appendTextField(std::streambuf& out_, const FieldView& field_)
+    {
+        out_.sputc(' ');
+        append(out_, field_._key, field_._keySize);
+        out_.sputc('=');
+        appendValue(out_, field_, false);
+    }
+
+    static void appendJsonField(std::streambuf& out_, const FieldView& field_)
+    {
+        appendLiteral(out_, ",\"");
+        appendEscaped(out_, field_._key, field_._keySize);
+        appendLiteral(out_, "\":");
+        appendValue(out_, field_, true);
+    }
+
+    /// The fields of a context rendered for the text and the JSON layouts.
+    struct RenderedContext
+    {
+        std::uint64_t   _id;
+        std::string     _text;
+        std::string     _json;
+    };
+
+    /// @return the fields of the context of msg_, rendered again only if
+    ///         the context of its thread changed
+    const RenderedContext& context(const LogRecord& msg_)
+    {
+        const auto thread = msg_._thread._index;
+        // the threads without an index share a single entry
+        if (thread != ThreadRegistry::unknown && _contexts.size() <= thread) {
+            _contexts.resize(thread + size_t{1}, RenderedContext{0, {}, {}});
+        }
+        auto& rendered = (thread != ThreadRegistry::unknown) ? _contexts[thread] : _unknownContext;
+        if (rendered._id != msg_._context->_id) {
+            std::stringbuf text;
+            std::stringbuf json;
+            const auto& fields = msg_._context->_fields;
+            forEachField(fields.data(), fields.data() + fields.size(), [&text, &json](const FieldView& field_) {
+                appendTextField(text, field_);
+                appendJsonField(json, field_);
+            });
+            rendered = RenderedContext{msg_._context->_id, text.str(), json.str()};
+        }
+        return rendered;
+    }
+
+    /// Write the value of the field as text, or as a JSON value if json_.
+    static void appendValue(std::streambuf& out_, const FieldView& field_, const bool json_)
+    {
+        switch (field_._type) {
+            case imp::FieldType::Bool:
+                if (field_._value[0] != 0) {
+                    appendLiteral(out_, "true");
+                } else {
+                    appendLiteral(out_, "false");
+                }
+                break;
+            case imp::FieldType::Signed: {
+                std::int64_t value;
+                std::memcpy(&value, field_._value, sizeof(value));
+                appendNumber(out_, value);
+                break;
+            }
+            case imp::FieldType::Unsigned: {
+                std::uint64_t value;
+                std::memcpy(&value, field_._value, sizeof(value));
+                char chars[24];
+                const auto begin = decimalDigits(chars + sizeof(chars), value);
+                append(out_, begin, static_cast<size_t>(chars + sizeof(chars) - begin));
+                break;
+            }
+            case imp::FieldType::Double: {
+                double value;
+                std::memcpy(&value, field_._value, sizeof(value));
+                if (json_ && !std::isfinite(value)) {
+                    appendLiteral(out_, "null");
+                    break;
+                }
+                char chars[32];
+                append(out_, chars, static_cast<size_t>(roundTripDouble(chars, value) - chars));
+                break;
+            }
+            case imp::FieldType::String:
+                if (json_) {
+                    out_.sputc('"');
+                    appendEscaped(out_, field_._value, field_._size);
+                    out_.sputc('"');
+                } else {
+                    append(out_, field_._value, field_._size);
+                }
+                break;
+        }
+    }
+
+    /// The message as a JSON object.
+    void appendJson(std::streambuf& out_
+        , const LogRecord& msg_
+        , const LineHeader& header_
+        , const std::string& thread_)
+    {
+        char fraction[10];
+        fraction[0] = '.';
+        auto nanos = nanosOf(msg_._time);
+        for (auto i = sizeof(fraction); --i > 0; nanos /= 10) {
+            fraction[i] = static_cast<char>('0' + nanos % 10);
+        }
+        const auto& label = labels()[static_cast<size_t>(msg_._priority)];
+        appendLiteral(out_, "{\"time\":\"");
+        append(out_, _isoTime, sizeof(_isoTime));
+        append(out_, fraction, sizeof(fraction));
+        appendLiteral(out_, "Z\",\"priority\":\"");
+        append(out_, label._data, label._size);
+        append(out_, header_._json.data(), header_._json.size());
+        appendEscaped(out_, thread_.data(), thread_.size());
+        appendLiteral(out_, "\",\"function\":\"");
+        appendEscaped(out_, msg_._function, std::strlen(msg_._function));
+        appendLiteral(out_, "\",\"file\":\"");
+        appendEscaped(out_, msg_._file, std::strlen(msg_._file));
+        appendLiteral(out_, "\",\"line\":");
+        appendNumber(out_, msg_._line);
+        appendLiteral(out_, ",\"message\":\"");
+        appendEscaped(out_, msg_._text, msg_._size);
+        out_.sputc('"');
+        if (msg_._context) {
+            const auto& json = context(msg_)._json;
+            append(out_, json.data(), json.size());
+        }
+        forEachField(msg_, [&out_](const FieldView& field_) {
+            appendJsonField(out_, field_);
+        });
+        out_.sputc('}');
+    }
+
+    /// Render the second of time_ if it changed.
+    /// @return the nanoseconds of time_ within its second
+    std::uint64_t nanosOf(const time_point_t time_)
+    {
+        const auto sinceEpoch = time_.time_since_epoch();
+        const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(sinceEpoch);
+        if (seconds.count() != _second) {
+            renderSecond(std::chrono::system_clock::to_time_t(time_));
+            _second = seconds.count();
+        }
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(sinceEpoch - seconds).count());
+    }
+
+    void appendTime(std::streambuf& out_, const time_point_t time_)
+    {
+        const auto nanos = nanosOf(time_);
+        append(out_, _time, _timeSize);
+        out_.sputc('.');
+        appendNumber(out_, static_cast<std::int64_t>(nanos));
+    }
+
+    /// Render the time as "%b %e %T" of the C locale and as the
+    /// "%Y-%m-%dT%H:%M:%S" of ISO 8601 for the JSON layout.
+    void renderSecond(const std::time_t time_)
+    {
+        static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+        struct tm tm;
+        if (!gmtime_r(&time_, &tm)) {
+            throw std::runtime_error("cannot get time for logging!");
+        }
+        const auto twoDigits = [this](const int value_, const char first_) {
+            _time[_timeSize++] = (value_ < 10) ? first_ : static_cast<char>('0' + value_ / 10);
+            _time[_timeSize++] = static_cast<char>('0' + value_ % 10);
+        };
+        std::memcpy(_time, months + 3 * tm.tm_mon, 3);
+        _timeSize = 3;
+        _time[_timeSize++] = ' ';
+        twoDigits(tm.tm_mday, ' ');
+        _time[_timeSize++] = ' ';
+        twoDigits(tm.tm_hour, '0');
+        _time[_timeSize++] = ':';
+        twoDigits(tm.tm_min, '0');
+        _time[_timeSize++] = ':';
+        twoDigits(tm.tm_sec, '0');
+
+        const auto digits = [this](const size_t at_, int value_, size_t count_) {
+            for (; count_ > 0; value_ /= 10) {
+                _isoTime[at_ + --count_] = static_cast<char>('0' + value_ % 10);
+            }
+        };
+        digits(0, tm.tm_year + 1900, 4);
+        _isoTime[4] = '-';
+        digits(5, tm.tm_mon + 1, 2);
+        _isoTime[7] = '-';
+        digits(8, tm.tm_mday, 2);
+        _isoTime[10] = 'T';
+        digits(11, tm.tm_hour, 2);
+        _isoTime[13] = ':';
+        digits(14, tm.tm_min, 2);
+        _isoTime[16] = ':';
+        digits(17, tm.tm_sec, 2);
+    }
+
+    std::int64_t    _second = std::numeric_limits<std::int64_t>::min();
+    char            _time[16];
+    size_t          _timeSize = 0;
+    char            _isoTime[19];
+    /// The last context rendered per thread index.
+    std::vector<RenderedContext>    _contexts;
+    /// The last context rendered for ThreadRegistry::unknown.
+    RenderedContext                 _unknownContext{0, {}, {}};
+    /// The line of a layout which is written as the message of a JSON object.
+    std::stringbuf                  _message;
 };
 
+//=============================================================================
+
 /**
- * This struct is the actual Logger implementation.
+ * This struct is the actual LoggingEngine implementation.
  * 
  * The main goal of this implementation is to preserve the chronological
- * order of the messages across all destinations regardless how many we have.
+ * order of the messages across all destinations regardless how many we have
+ * and how many Loggers write to them.
  * To achieve this a priority queue is used which can always return the
- * earliest log message as its top element.
+ * earliest log message as its top element. A single backend thread pops
+ * a batch of messages and formats each of them once into a single buffer.
+ * Then every destination receives all of its lines of the batch in one call
+ * while the backend holds the writer mutex of the destination. This way a
+ * destination shared by many Loggers gets complete lines in chronological
+ * order, and complete batches even if the Loggers use different engines.
+ * Destinations with deduplication enabled skip the consecutive repetitions
+ * of a message and get a summary line instead.
  * 
- * A vector is used to store the log destinations which needs to be
- * derived from LogDest.
+ * The producers copy the texts of the messages into blocks of the pool of the
+ * engine, which the backend hands back in bulk after formatting them. The
+ * queues and the batch buffer keep their memory between the batches, so in
+ * the steady state queuing a message does not allocate.
+ * 
+ * Every accepted message is counted in the current flush epoch until the
+ * backend writes it. A flush closes the current epoch and waits for the
+ * backend to drain every epoch up to it and to flush the destinations of
+ * the attached Loggers. Producers simply continue in the new epoch.
  * 
  * There are some known shortcoming with the current implementation:
  *   * queuing is not the most efficient way to handle concurrent writers
@@ -78,21 +1688,79 @@ struct LogTarget
  *       With adequate facilities to convert it to human readable format and to allow quick
  *       searching or even issue reporting it can and should replace text-base logging.
  */
-struct Logger::Impl
+struct LoggingEngine::Impl
 {
-    using time_point_t = std::chrono::system_clock::time_point;
-    using queue_element_t = std::pair<time_point_t, std::pair<Priority, std::string>>;
-    using priority_queue_t = std::priority_queue<queue_element_t
-        , std::vector<queue_element_t>
-        , std::greater<queue_element_t>>;
-    using dests_t = std::vector<LogTarget>;
-
-    Impl(const Priority globalThreshold_
-        , const std::string& category_)
-        : _globalThreshold{globalThreshold_}
-        , _category{category_}
+    /// The lines of a batch a destination has to write, as indices of the
+    /// formatted lines.
+    using dest_lines_t = pmr_vector_t<std::pair<LogDest*, pmr_vector_t<size_t>>>;
+    /// The rendered lines of a batch are kept for the next batch up to
+    /// this size, the memory of larger batches is given back.
+    static const size_t retainedBatch = 1024 * 1024;
+
+    explicit Impl(cpp17::pmr::memory_resource* resource_)
+        : _resource{resource_}
+        , _pool{std::make_shared<BlockPool>(resource_)}
+        , _queue{cpp17::pmr::polymorphic_allocator<LogRecord>{resource_}}
     {
         _logger = std::thread{[this]() {
+            const cpp17::pmr::polymorphic_allocator<char> alloc{_resource};
+            pmr_vector_t<std::pair<epoch_t, size_t>> written{alloc};
+            /// Sources and log times of the messages in the batch.
+            pmr_vector_t<std::pair<const LogSource*, time_point_t>> logged{alloc};
+            BatchBuffer buffer{_resource};
+            std::ostream formattedMsg{&buffer};
+            formattedMsg.imbue(imp::numericLocale());
+            /// Offsets and sizes of the formatted lines in the batch.
+            pmr_vector_t<std::pair<size_t, size_t>> formatted{alloc};
+            const auto addLine = [&buffer, &formatted](const size_t begin_) {
+                formatted.emplace_back(begin_, buffer.size() - begin_);
+                return formatted.size() - 1;
+            };
+            /// The blocks of the written messages and their reference counts.
+            pmr_vector_t<std::pair<Block*, std::uint32_t>> blocks{alloc};
+            /// Swapped with the queue, so both keep their capacity.
+            record_queue_t localQueue{cpp17::pmr::polymorphic_allocator<LogRecord>{_resource}};
+            /// Keeps the routes of the batch alive until they are written.
+            pmr_vector_t<dest_set_ptr_t> dests{alloc};
+            /// The retired targets taken from the sources, alive until written and flushed.
+            dests_t retired;
+            dest_lines_t destLines{alloc};
+            pmr_vector_t<LogLine> lines{alloc};
+            /// The text of the current deferred message.
+            BatchBuffer deferredBuffer{_resource};
+            std::ostream deferredMsg{&deferredBuffer};
+            deferredMsg.imbue(imp::numericLocale());
+            LogRecord rendered{};
+            LineFormatter lineFormatter;
+            /// The line of the current message per layout group, npos until rendered.
+            pmr_vector_t<size_t> groupLines{alloc};
+            /// The "last message repeated N times" summary of a Dedup as a message.
+            std::string summaryText;
+            LogRecord summarized{};
+            const auto summary = [&summaryText, &summarized](const Dedup& dedup_) -> const LogRecord& {
+                summaryText = "last message repeated " + std::to_string(dedup_._repeated) + " times";
+                summarized = LogRecord{std::chrono::system_clock::now(), 0, 0, nullptr, dedup_._priority
+                    , dedup_._function, dedup_._file, dedup_._line
+                    , ThreadRegistry::Thread{dedup_._thread, dedup_._threadText}
+                    , summaryText.data(), summaryText.size(), 0, nullptr, nullptr, nullptr};
+                return summarized;
+            };
+            const auto render = [&deferredBuffer, &deferredMsg, &rendered](const LogRecord& msg_) -> const LogRecord& {
+                deferredBuffer.clear();
+                deferredMsg.clear();
+                try {
+                    msg_._deferred->write(deferredMsg);
+                } catch (const std::exception& e_) {
+                    deferredMsg << "cannot render the message: " << e_.what();
+                } catch (...) {
+                    // nothing may leave the backend thread
+                    deferredMsg << "cannot render the message";
+                }
+                rendered = msg_;
+                rendered._text = deferredBuffer.data();
+                rendered._size = deferredBuffer.size();
+                return rendered;
+            };
             while (true) {
                 std::unique_lock<std::mutex> ulw{_writeMutex};
                 
@@ -100,112 +1768,499 @@ struct Logger::Impl
                     break;
                 }
                 
-                _writeCond.wait_for(ulw, _maxWait, [this]() { return !_queue.empty(); });
-                priority_queue_t localQueue;
+                _writeCond.wait_for(ulw, _maxWait, [this]() { return !_queue.empty() || !_log || flushRequested(); });
                 localQueue.swap(_queue);
                 ulw.unlock();
 
-                std::lock_guard<std::mutex> lgd{_destMutex};
+                written.clear();
+                logged.clear();
+                formatted.clear();
+                buffer.clear();
+                const LogSource* source = nullptr;
+                std::shared_ptr<const LineHeader> header;
                 while (!localQueue.empty()) {
-                    const auto msg = localQueue.top();
+                    const auto& msg = localQueue.top()._deferred ? render(localQueue.top()) : localQueue.top();
+                    if (msg._source != source) {
+                        source = msg._source;
+                        header = std::atomic_load(&source->_header);
+                        if (source->_retiring.load()) {
+                            const auto first = retired.size();
+                            {
+                                std::lock_guard<std::mutex> lgr{source->_retiredMutex};
+                                takeRetired(*source, retired);
+                                dests.push_back(std::atomic_load(&source->_dests));
+                            }
+                            // before any line the new snapshot routes
+                            for (auto i = first; i < retired.size(); ++i) {
+                                const auto& target = retired[i];
+                                if (target._dest && target._dedup->_repeated != 0) {
+                                    const auto begin = buffer.size();
+                                    const auto& repeated = summary(*target._dedup);
+                                    lineFormatter.format(buffer, repeated, *header, *repeated._thread._text
+                                        , *target._layout, target._jsonMessage);
+                                    linesOf(destLines, target._dest.get()).push_back(addLine(begin));
+                                    target._dedup->reset(nullptr, 0, 0, time_point_t{});
+                                }
+                            }
+                        } else {
+                            dests.push_back(std::atomic_load(&source->_dests));
+                        }
+                    }
+                    const auto& route = dests.back()->_routes[static_cast<size_t>(msg._priority)];
+                    groupLines.assign(dests.back()->_groups, std::string::npos);
+                    auto hash = std::uint64_t{0};
+                    auto hashed = false;
+                    for (const auto& entry : route) {
+                        if (entry._dedup) {
+                            if (!hashed) {
+                                hash = hashBytes(msg._text, msg._size + msg._fields);
+                                if (msg._context) {
+                                    hash = (hash ^ msg._context->_id) * 0x100000001b3ull;
+                                }
+                                hashed = true;
+                            }
+                            if (entry._dedup->repeats(msg._file, msg._line, hash, msg._time)) {
+                                entry._dest->_deduplicated.fetch_add(1, std::memory_order_relaxed);
+                                continue;
+                            }
+                            if (entry._dedup->_repeated != 0) {
+                                const auto begin = buffer.size();
+                                const auto& repeated = summary(*entry._dedup);
+                                lineFormatter.format(buffer, repeated, *header, *repeated._thread._text, *entry._layout, entry._jsonMessage);
+                                linesOf(destLines, entry._dest).push_back(addLine(begin));
+                            }
+                            entry._dedup->reset(msg._file, msg._line, hash, msg._time);
+                            entry._dedup->remember(msg._priority, msg._function, msg._thread._index, msg._thread._text);
+                        }
+                        auto& line = groupLines[entry._group];
+                        if (line == std::string::npos) {
+                            const auto begin = buffer.size();
+                            lineFormatter.format(buffer, msg, *header, *msg._thread._text, *entry._layout, entry._jsonMessage);
+                            line = addLine(begin);
+                        }
+                        linesOf(destLines, entry._dest).push_back(line);
+                    }
+                    if (!written.empty() && written.back().first == msg._epoch) {
+                        ++written.back().second;
+                    } else {
+                        written.emplace_back(msg._epoch, 1);
+                    }
+                    logged.emplace_back(msg._source, msg._time);
+                    if (msg._context) {
+                        ContextRegistry::instance().release(msg._context);
+                    }
+                    if (msg._deferred) {
+                        delete msg._deferred;
+                    } else if (!msg._block) {
+                        _resource->deallocate(const_cast<char*>(msg._text), msg._size + msg._fields, 1);
+                    } else if (!blocks.empty() && blocks.back().first == msg._block) {
+                        ++blocks.back().second;
+                    } else {
+                        blocks.emplace_back(msg._block, 1);
+                    }
                     localQueue.pop();
-                    for (auto& target : _dests) {
-                        if (target._enabled && !(msg.second.first < target._threshold) && target._dest) {
-                            target._dest->write(msg.second.second);
+                }
+                header.reset();
+                // every text is formatted, the blocks can be reused
+                for (const auto& blockCount : blocks) {
+                    BlockPool::release(blockCount.first, blockCount.second);
+                }
+                blocks.clear();
+
+                if (!formatted.empty()) {
+                    const auto batch = buffer.data();
+                    /// The lines the views in lines show.
+                    const pmr_vector_t<size_t>* viewed = nullptr;
+                    auto bytes = size_t{0};
+                    for (auto& destLine : destLines) {
+                        if (!destLine.second.empty()) {
+                            // the destinations of a layout group usually write the same lines
+                            if (!viewed || *viewed != destLine.second) {
+                                lines.clear();
+                                bytes = 0;
+                                for (const auto i : destLine.second) {
+                                    lines.push_back(LogLine{batch + formatted[i].first, formatted[i].second});
+                                    bytes += formatted[i].second;
+                                }
+                                viewed = &destLine.second;
+                            }
+                            std::lock_guard<std::mutex> lgd{destLine.first->_writerMutex};
+                            const auto start = std::chrono::steady_clock::now();
+                            destLine.first->write(lines.data(), lines.size());
+                            const auto took = std::chrono::steady_clock::now() - start;
+                            destLine.first->_lines.fetch_add(lines.size(), std::memory_order_relaxed);
+                            destLine.first->_bytes.fetch_add(bytes, std::memory_order_relaxed);
+                            destLine.first->_writeNanos.fetch_add(static_cast<std::uint64_t>(
+                                std::chrono::duration_cast<std::chrono::nanoseconds>(took).count()), std::memory_order_relaxed);
+                        }
+                    }
+                    for (auto& destLine : destLines) {
+                        destLine.second.clear();
+                    }
+                }
+                // every destination wrote its lines
+                buffer.shrink(retainedBatch);
+                dests.clear();
+
+                // the sources are alive until their messages are retired
+                const auto now = std::chrono::system_clock::now();
+                for (const auto& sourceTime : logged) {
+                    const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(now - sourceTime.second).count();
+                    sourceTime.first->_latency.record(static_cast<std::uint64_t>(std::max<std::int64_t>(latency, 0)));
+                }
+
+                ulw.lock();
+                retire(written);
+                if (_firstEpoch > _flushedEpoch) {
+                    const auto drained = _firstEpoch;
+                    ulw.unlock();
+                    {
+                        std::lock_guard<std::mutex> lgs{_sourcesMutex};
+                        const auto writeSummary = [&](const LogTarget& target_, const LineHeader& header_) {
+                            if (target_._dest) {
+                                linesOf(destLines, target_._dest.get());
+                            }
+                            if (target_._dest && target_._dedup && target_._dedup->_repeated != 0) {
+                                const auto& repeated = summary(*target_._dedup);
+                                buffer.clear();
+                                lineFormatter.format(buffer, repeated, header_
+                                    , *repeated._thread._text, *target_._layout, target_._jsonMessage);
+                                const LogLine line{buffer.data(), buffer.size()};
+                                std::lock_guard<std::mutex> lgd{target_._dest->_writerMutex};
+                                target_._dest->write(&line, 1);
+                                target_._dest->_lines.fetch_add(1, std::memory_order_relaxed);
+                                target_._dest->_bytes.fetch_add(line._size, std::memory_order_relaxed);
+                                target_._dedup->reset(nullptr, 0, 0, time_point_t{});
+                            }
+                        };
+                        for (const auto src : _sources) {
+                            const auto srcHeader = std::atomic_load(&src->_header);
+                            if (src->_retiring.load()) {
+                                const auto first = retired.size();
+                                {
+                                    std::lock_guard<std::mutex> lgr{src->_retiredMutex};
+                                    takeRetired(*src, retired);
+                                }
+                                for (auto i = first; i < retired.size(); ++i) {
+                                    writeSummary(retired[i], *srcHeader);
+                                }
+                            }
+                            // the snapshot has to outlive the loop, a reconfiguration may replace it
+                            const auto srcDests = std::atomic_load(&src->_dests);
+                            for (const auto& target : srcDests->_targets) {
+                                writeSummary(target, *srcHeader);
+                            }
                         }
                     }
+                    for (auto& destLine : destLines) {
+                        std::lock_guard<std::mutex> lgd{destLine.first->_writerMutex};
+                        destLine.first->flush();
+                    }
+                    ulw.lock();
+                    _flushedEpoch = drained;
+                    _flushCond.notify_all();
                 }
+                destLines.clear();
+                retired.clear();
             }
         }};
     }
     ~Impl()
     {
-        _log = false;
-        _logger.join();
-
-        if (_verifCB) {
-            for (auto& target : _dests) {
-                if (target._dest) {
-                    target._dest->flush();
-                }
-            }
-            _verifCB(_requestedErrors.load());
+        flush();
+        {
+            std::lock_guard<std::mutex> lg{_writeMutex};
+            _log = false;
+        }
+        _writeCond.notify_one();
+        _logger.join();
+        _pool->close();
+    }
+
+    /// Move the retired targets of source_ to the end of retired_.
+    /// @pre the _retiredMutex of source_ is locked
+    static void takeRetired(const LogSource& source_, dests_t& retired_)
+    {
+        for (auto& target : source_._retired) {
+            retired_.push_back(std::move(target));
+        }
+        source_._retired.clear();
+        source_._retiring = false;
+    }
+
+    /// @return the lines to be written to dest_ in this batch
+    static pmr_vector_t<size_t>& linesOf(dest_lines_t& destLines_, LogDest* dest_)
+    {
+        const auto it = std::find_if(destLines_.begin(), destLines_.end(), [dest_](const dest_lines_t::value_type& destLine_) {
+            return dest_ == destLine_.first;
+        });
+        if (it != destLines_.end()) {
+            return it->second;
+        }
+        destLines_.emplace_back(dest_, pmr_vector_t<size_t>{destLines_.get_allocator()});
+        return destLines_.back().second;
+    }
+
+    /// Copy the text and the fields of the message into the block of the
+    /// thread if they fit.
+    void push(LogRecord&& msg_, const char* message_, const LogLine& fields_)
+    {
+        thread_local ThreadArena arena;
+        const auto size = msg_._size + fields_._size;
+        auto text = arena.allocate(_pool, size, msg_._block);
+        if (!text) {
+            text = static_cast<char*>(_resource->allocate(size, 1));
+        }
+        std::memcpy(text, message_, msg_._size);
+        if (fields_._size != 0) {
+            std::memcpy(text + msg_._size, fields_._data, fields_._size);
+        }
+        msg_._text = text;
+        msg_._fields = static_cast<std::uint32_t>(fields_._size);
+        push(std::move(msg_));
+    }
+    void push(LogRecord&& msg_)
+    {
+        {
+            std::lock_guard<std::mutex> lg{_writeMutex};
+            msg_._seq = _seq++;
+            msg_._epoch = currentEpoch();
+            ++_pending.back();
+            _peakDepth = std::max(_peakDepth, ++_depth);
+            _queue.push(std::move(msg_));
+        }
+        _writeCond.notify_one();
+    }
+
+    void flush()
+    {
+        std::unique_lock<std::mutex> ul{_writeMutex};
+        const auto target = requestFlush();
+        _flushCond.wait(ul, [this, target]() { return target < _flushedEpoch; });
+    }
+
+    bool flush(const std::chrono::milliseconds timeout_)
+    {
+        std::unique_lock<std::mutex> ul{_writeMutex};
+        const auto target = requestFlush();
+        return _flushCond.wait_for(ul, timeout_, [this, target]() { return target < _flushedEpoch; });
+    }
+
+    void attach(const LogSource& source_)
+    {
+        std::lock_guard<std::mutex> lg{_sourcesMutex};
+        _sources.push_back(&source_);
+    }
+
+    /// @pre every message of the source is written
+    void detach(const LogSource& source_)
+    {
+        std::lock_guard<std::mutex> lg{_sourcesMutex};
+        _sources.erase(std::remove(_sources.begin(), _sources.end(), &source_), _sources.end());
+    }
+
+    /// @pre _writeMutex is locked
+    epoch_t currentEpoch() const
+    {
+        return _firstEpoch + _pending.size() - 1;
+    }
+
+    /// Close the current flush epoch and wake up the backend.
+    /// The caller is done when _flushedEpoch passes the returned epoch.
+    /// @pre _writeMutex is locked
+    epoch_t requestFlush()
+    {
+        const auto target = currentEpoch();
+        _pending.push_back(0);
+        _writeCond.notify_one();
+        return target;
+    }
+
+    /// @pre _writeMutex is locked
+    bool flushRequested() const
+    {
+        return _pending.size() > 1 && _pending.front() == 0;
+    }
+
+    /// Account the written messages and drop the drained epochs.
+    /// @pre _writeMutex is locked
+    void retire(const pmr_vector_t<std::pair<epoch_t, size_t>>& written_)
+    {
+        for (const auto& epochCount : written_) {
+            _pending[epochCount.first - _firstEpoch] -= epochCount.second;
+            _depth -= epochCount.second;
+        }
+        while (flushRequested()) {
+            _pending.pop_front();
+            ++_firstEpoch;
+        }
+    }
+
+    Impl(const Impl&) = delete;
+    Impl& operator=(const Impl&) = delete;
+    Impl(Impl&&) = delete;
+    Impl& operator=(Impl&&) = delete;
+
+    cpp17::pmr::memory_resource*    _resource;
+    /// Memory of the texts of the queued messages.
+    std::shared_ptr<BlockPool>      _pool;
+    record_queue_t                  _queue;
+    std::uint64_t                   _seq{0};
+    /// Number of pushed but not yet written messages and its maximum.
+    std::uint64_t                   _depth{0};
+    std::uint64_t                   _peakDepth{0};
+
+    std::mutex                      _writeMutex;
+    std::condition_variable         _writeCond;
+
+    /// The attached Loggers, their destinations are flushed by the backend.
+    std::vector<const LogSource*>   _sources;
+    std::mutex                      _sourcesMutex;
+
+    std::thread                     _logger;
+    std::atomic_bool                _log{true};
+
+    /// Number of not yet written messages per flush epoch.
+    /// The front belongs to _firstEpoch, the back is the current epoch.
+    std::deque<size_t>              _pending = std::deque<size_t>(1);
+    epoch_t                         _firstEpoch{0};
+    /// Every epoch before this one is written and flushed.
+    epoch_t                         _flushedEpoch{0};
+    std::condition_variable         _flushCond;
+
+    std::chrono::seconds            _maxWait{1ul};
+};
+
+//=============================================================================
+
+/**
+ * This struct is the actual Logger implementation.
+ * 
+ * It filters and counts the messages then hands them over to its
+ * LoggingEngine, which may be shared with other Loggers.
+ * 
+ * A vector is used to store the log destinations which needs to be
+ * derived from LogDest. The vector is never modified in place: every
+ * reconfiguration copies it, rebuilds the routing table listing the
+ * destinations writing each priority and atomically publishes the new
+ * snapshot. The backend and the queries only load the current snapshot,
+ * so they do not wait for a reconfiguration to finish, and the backend
+ * does not evaluate the destination settings per message. Note that the
+ * std::atomic_load and std::atomic_store of a shared_ptr take a short
+ * internal lock in the common standard libraries, so this is lock-based,
+ * not wait-free: loading a snapshot only waits for another load or store
+ * of the pointer, never for a copy of the destinations.
+ * The lowest priority present in the table is kept in an atomic as well,
+ * so the macros can drop messages nobody would write before they are
+ * even formatted. The category is published the same way.
+ */
+struct Logger::Impl : LogSource
+{
+    Impl(const LoggingEngine::ptr_t& engine_
+        , const Priority globalThreshold_
+        , const std::string& category_)
+        : _engine{engine_ ? engine_ : std::make_shared<LoggingEngine>()}
+        , _globalThreshold{globalThreshold_}
+    {
+        _header = std::make_shared<const LineHeader>(category_);
+        _dests = std::make_shared<const DestSet>();
+        _engine->_pImpl->attach(*this);
+    }
+    ~Impl()
+    {
+        reportSuppressed();
+        _engine->_pImpl->flush();
+        _engine->_pImpl->detach(*this);
+
+        if (_verifCB) {
+            _verifCB(_requestedErrors.load());
+        }
+    }
+
+    /// Count the message.
+    /// @return true if it has to be queued
+    bool admit(const Priority pri_)
+    {
+        if (!accepts(pri_)) {
+            count(&Counters::_rejected, pri_);
+            return false;
+        }
+        count(&Counters::_accepted, pri_);
+
+        if (_verifCB && !(pri_ < _errorThreshold.load(std::memory_order_relaxed))) {
+            ++_requestedErrors;
+        }
+        return true;
+    }
+    void log(const char* message_
+        , const size_t size_
+        , const LogLine& fields_
+        , const Priority pri_
+        , const char* function_
+        , const char* file_
+        , int line_
+        , const std::thread::id threadId_)
+    {
+        if (admit(pri_)) {
+            _engine->_pImpl->push(LogRecord{std::chrono::system_clock::now(), 0, 0, this, pri_
+                , function_, file_, line_, threadOf(threadId_), nullptr, size_, 0, retainContext(), nullptr, nullptr}, message_, fields_);
         }
     }
-
-    void log(std::string&& message_
+    void log(std::unique_ptr<DeferredText>&& text_
         , const Priority pri_
         , const char* function_
         , const char* file_
         , int line_
         , const std::thread::id threadId_)
     {
-        {
-            std::lock_guard<std::mutex> lg{_writeMutex};
-            if (pri_ < _globalThreshold) {
-                return;
-            }
-
-            if (_verifCB && !(pri_ < _errorThreshold)) {
-                ++_requestedErrors;
-            }
+        if (admit(pri_)) {
+            _engine->_pImpl->push(LogRecord{std::chrono::system_clock::now(), 0, 0, this, pri_
+                , function_, file_, line_, threadOf(threadId_), nullptr, 0, 0, retainContext(), nullptr, text_.release()});
         }
+    }
 
-        /// @todo Every log call starts up a new thread to push into the queue.
-        ///       Using a thread-pool would prevent starting up too many threads.
-        auto now = std::chrono::system_clock::now();
-        std::thread{[this, now, pri_, function_, file_, line_, threadId_](std::string&& message_) {
-            std::ostringstream formattedMsg;
-            auto time = std::chrono::system_clock::to_time_t(now);
-            struct tm tm;
-            if (!gmtime_r(&time, &tm)) {
-                throw std::runtime_error("cannot get time for logging!");
-            }
-            const auto total_nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
-            const auto total_seconds_in_nanos = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count() * 1000 * 1000 * 1000;
-            const auto nanos = total_nanos - total_seconds_in_nanos;
-
-            /// @todo Accessing _category here is not thread-safe, but always locking to build the message sounds too expansive
-            ///       to make the 0.001% case thread-safe. A better solution needed.
-            formattedMsg << std::put_time(&tm, "%b %e %T") << '.' << nanos << ' ' << threadId_ << ' ' << _category << ' ' << function_ << ' ' << pri_ <<
-                ": " << std::move(message_) << " (" << file_ << ':' << line_ << ")\n";
-            
-            {
-                std::lock_guard<std::mutex> lg{_writeMutex};
-                _queue.push(std::make_pair(std::move(now), std::make_pair(pri_, formattedMsg.str())));
-            }
-            _writeCond.notify_one();
-        }
-        , std::move(message_)}.detach();
+    void flush()
+    {
+        reportSuppressed();
+        _engine->_pImpl->flush();
     }
 
-    void category(const std::string& category_)
+    bool flush(const std::chrono::milliseconds timeout_)
     {
-        std::lock_guard<std::mutex> lg{_writeMutex};
-        _category = category_;
+        reportSuppressed();
+        return _engine->_pImpl->flush(timeout_);
     }
 
-    void addDest(const std::string& name_, LogDest::ptr_t&& dest_)
+    void category(const std::string& category_)
     {
-        std::lock_guard<std::mutex> lg{_destMutex};
-        _dests.emplace_back(name_, std::move(dest_), _globalThreshold, true);
+        std::atomic_store(&_header, std::make_shared<const LineHeader>(category_));
     }
 
-    void addDest(const std::string& name_, const Priority thresHold_, LogDest::ptr_t&& dest_)
+    void addDest(const std::string& name_, const Priority thresHold_, const LogDest::shared_ptr_t& dest_)
     {
-        std::lock_guard<std::mutex> lg{_destMutex};
-        _dests.emplace_back(name_, std::move(dest_), thresHold_, true);
+        reconfigure([&](dests_t& targets_) {
+            auto layout = dest_ ? std::atomic_load(&dest_->_layout) : nullptr;
+            if (!layout) {
+                layout = layoutOf(Layout::classic);
+            }
+            targets_.emplace_back(name_, dest_, thresHold_, true, layout
+                , dest_ && dest_->jsonLines() && layout->pattern() != Layout::json);
+            return true;
+        });
     }
 
     void permitDest(const std::string& name_, const bool enable_)
     {
-        std::lock_guard<std::mutex> lg{_destMutex};
-        const auto it = std::find_if(_dests.begin(), _dests.end(), [&name_](const dests_t::value_type& target_) {
-            return name_ == target_._name;
-        });
-        if (it != _dests.end()) {
+        reconfigure([&](dests_t& targets_) {
+            const auto it = std::find_if(targets_.begin(), targets_.end(), [&name_](const dests_t::value_type& target_) {
+                return name_ == target_._name;
+            });
+            if (it == targets_.end() || it->_enabled == enable_) {
+                return false;
+            }
             it->_enabled = enable_;
-        }
+            return true;
+        });
     }
 
     void threshold(const Priority globalThreshold_)
@@ -217,19 +2272,35 @@ struct Logger::Impl
         ///       setting. It is quiet inconvenient.<br/>
         ///       There should be a setting for every individual LogDest to specify
         ///       whether it follows the global threshold or not.
-        std::lock_guard<std::mutex> lg{_writeMutex};
         _globalThreshold = globalThreshold_;
     }
 
     void threshold(const std::string& destName_, const Priority threshold_)
     {
-        std::lock_guard<std::mutex> lg{_destMutex};
-        const auto it = std::find_if(_dests.begin(), _dests.end(), [&destName_](const dests_t::value_type& target_) {
-            return destName_ == target_._name;
-        });
-        if (it != _dests.end()) {
+        reconfigure([&](dests_t& targets_) {
+            const auto it = std::find_if(targets_.begin(), targets_.end(), [&destName_](const dests_t::value_type& target_) {
+                return destName_ == target_._name;
+            });
+            if (it == targets_.end() || it->_threshold == threshold_) {
+                return false;
+            }
             it->_threshold = threshold_;
-        }
+            return true;
+        });
+    }
+
+    void dedup(const std::string& destName_, const std::chrono::milliseconds window_)
+    {
+        reconfigure([&](dests_t& targets_) {
+            const auto it = std::find_if(targets_.begin(), targets_.end(), [&destName_](const dests_t::value_type& target_) {
+                return destName_ == target_._name;
+            });
+            if (it == targets_.end()) {
+                return false;
+            }
+            it->_dedup = (window_.count() > 0) ? std::make_shared<Dedup>(window_) : nullptr;
+            return true;
+        });
     }
 
     void verifyCB(const verif_cb_t& cb_)
@@ -239,35 +2310,191 @@ struct Logger::Impl
 
     void errorThreshold(const Priority errorThreshold_)
     {
-        std::lock_guard<std::mutex> lg{_writeMutex};
         _errorThreshold = errorThreshold_;
     }
 
-    const std::string& category() const
+    std::string category() const
+    {
+        return std::atomic_load(&_header)->_category;
+    }
+
+    Priority threshold() const
     {
-        std::lock_guard<std::mutex> lg{_writeMutex};
-        return _category;
+        return _globalThreshold;
     }
 
     Priority errorThreshold() const
     {
-        std::lock_guard<std::mutex> lg{_writeMutex};
         return _errorThreshold;
     }
 
     bool logging(const Priority pri_) const
     {
-        std::lock_guard<std::mutex> lg{_writeMutex};
-        return !(pri_ < _globalThreshold);
+        return !(pri_ < _globalThreshold.load(std::memory_order_relaxed));
+    }
+
+    bool accepts(const Priority pri_) const
+    {
+        return logging(pri_) && !(pri_ < _destFloor.load(std::memory_order_relaxed));
+    }
+
+    bool accepts(const Priority pri_
+        , LogSite& site_
+        , const char* function_
+        , const char* file_
+        , const int line_) const
+    {
+        if (!accepts(pri_)) {
+            count(&Counters::_rejected, pri_);
+            return false;
+        }
+        const auto& limit = _rateLimits[static_cast<size_t>(pri_)];
+        if (!site_.admit(RateLimit{limit._perSecond.load(std::memory_order_relaxed)
+            , limit._burst.load(std::memory_order_relaxed)
+            , limit._everyNth.load(std::memory_order_relaxed)
+            , limit._probability.load(std::memory_order_relaxed)})) {
+            count(&Counters::_suppressed, pri_);
+            if (!site_._listed.load(std::memory_order_relaxed) && !site_._listed.exchange(true, std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> lg{_sitesMutex};
+                _suppressingSites.push_back(SuppressingSite{&site_, pri_, function_, file_, line_});
+            }
+            return false;
+        }
+        return true;
+    }
+
+    /// Log the messages suppressed at the listed sites since their last
+    /// logged message, the next message of a site would report them only
+    /// if it came.
+    void reportSuppressed()
+    {
+        std::vector<SuppressingSite> sites;
+        {
+            std::lock_guard<std::mutex> lg{_sitesMutex};
+            sites.swap(_suppressingSites);
+        }
+        for (const auto& site : sites) {
+            site._site->_listed.store(false, std::memory_order_relaxed);
+            const auto suppressed = site._site->suppressed();
+            if (suppressed._count != 0) {
+                const auto text = std::to_string(suppressed._count) + " similar messages suppressed";
+                _engine->_pImpl->push(LogRecord{std::chrono::system_clock::now(), 0, 0, this, site._priority
+                    , site._function, site._file, site._line, threadOf(std::this_thread::get_id()), nullptr, text.size(), 0
+                    , nullptr, nullptr, nullptr}, text.data(), LogLine{nullptr, 0});
+            }
+        }
+    }
+
+    void rateLimit(const Priority pri_, const RateLimit& limit_)
+    {
+        auto& limit = _rateLimits[static_cast<size_t>(pri_)];
+        limit._perSecond = limit_._perSecond;
+        limit._burst = limit_._burst;
+        limit._everyNth = limit_._everyNth;
+        limit._probability = limit_._probability;
+    }
+
+    LogStats stats() const
+    {
+        LogStats stats;
+        stats._accepted.fill(0);
+        stats._rejected.fill(0);
+        stats._suppressed.fill(0);
+        for (const auto& shard : _counters) {
+            for (auto i = size_t{0}; i < stats._accepted.size(); ++i) {
+                stats._accepted[i] += shard._accepted[i].load(std::memory_order_relaxed);
+                stats._rejected[i] += shard._rejected[i].load(std::memory_order_relaxed);
+                stats._suppressed[i] += shard._suppressed[i].load(std::memory_order_relaxed);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lg{_engine->_pImpl->_writeMutex};
+            stats._queueDepth = _engine->_pImpl->_depth;
+            stats._peakQueueDepth = _engine->_pImpl->_peakDepth;
+        }
+        stats._arenaBytes = _engine->_pImpl->_pool->reserved();
+        stats._latency = _latency.snapshot();
+        // the snapshot has to outlive the loop, a reconfiguration may replace it
+        const auto dests = std::atomic_load(&_dests);
+        for (const auto& target : dests->_targets) {
+            if (target._dest) {
+                const auto& dest = *target._dest;
+                stats._dests.push_back(LogStats::Dest{target._name
+                    , dest._lines.load(std::memory_order_relaxed)
+                    , dest._bytes.load(std::memory_order_relaxed)
+                    , std::chrono::nanoseconds{static_cast<std::chrono::nanoseconds::rep>(dest._writeNanos.load(std::memory_order_relaxed))}
+                    , dest._deduplicated.load(std::memory_order_relaxed)});
+            }
+        }
+        return stats;
     }
 
     bool logging(const std::string& destName_) const
     {
-        std::lock_guard<std::mutex> lg{_destMutex};
-        const auto cit = std::find_if(_dests.cbegin(), _dests.cend(), [&destName_](const dests_t::value_type& target_) {
+        const auto dests = std::atomic_load(&_dests);
+        const auto cit = std::find_if(dests->_targets.cbegin(), dests->_targets.cend(), [&destName_](const dests_t::value_type& target_) {
             return destName_ == target_._name;
         });
-        return (cit == _dests.cend()) ? false : cit->_enabled;
+        return (cit == dests->_targets.cend()) ? false : cit->_enabled;
+    }
+
+    /// Copy the current destinations, let modify_ change the copy and if
+    /// it reports a change publish the copy with a fresh routing table.
+    /// Readers keep using the snapshot they loaded, they only wait for the
+    /// atomic store of the new one, not for the copy. The targets whose
+    /// Dedup is dropped are retired, so the backend still summarizes them.
+    template <class Modifier>
+    void reconfigure(Modifier&& modify_)
+    {
+        std::lock_guard<std::mutex> lg{_destMutex};
+        const auto previous = std::atomic_load(&_dests);
+        auto dests = std::make_shared<DestSet>(*previous);
+        if (!modify_(dests->_targets)) {
+            return;
+        }
+        dests_t retired;
+        for (const auto& target : previous->_targets) {
+            if (target._dedup && std::none_of(dests->_targets.cbegin(), dests->_targets.cend()
+                , [&target](const dests_t::value_type& target_) { return target_._dedup == target._dedup; })) {
+                retired.push_back(target);
+            }
+        }
+        dests->_floor = Priority::__Size;
+        std::vector<std::pair<const Layout*, bool>> layouts;
+        const auto groupOf = [&layouts](const LogTarget& target_) {
+            const auto layout = std::make_pair(target_._layout.get(), target_._jsonMessage);
+            const auto found = std::find(layouts.cbegin(), layouts.cend(), layout);
+            if (found != layouts.cend()) {
+                return static_cast<size_t>(found - layouts.cbegin());
+            }
+            layouts.push_back(layout);
+            return layouts.size() - 1;
+        };
+        for (auto i = dests->_routes.size(); i-- > 0; ) {
+            const auto pri = static_cast<Priority>(i);
+            dests->_routes[i].clear();
+            for (const auto& target : dests->_targets) {
+                if (target._enabled && !(pri < target._threshold) && target._dest) {
+                    dests->_routes[i].push_back(RouteEntry{target._dest.get(), target._dedup.get(), target._layout.get()
+                        , target._jsonMessage, groupOf(target)});
+                }
+            }
+            if (!dests->_routes[i].empty()) {
+                dests->_floor = pri;
+            }
+        }
+        dests->_groups = layouts.size();
+        _destFloor = dests->_floor;
+        if (retired.empty()) {
+            std::atomic_store(&_dests, dest_set_ptr_t{std::move(dests)});
+            return;
+        }
+        std::lock_guard<std::mutex> lgr{_retiredMutex};
+        for (auto& target : retired) {
+            _retired.push_back(std::move(target));
+        }
+        _retiring = true;
+        std::atomic_store(&_dests, dest_set_ptr_t{std::move(dests)});
     }
 
     Impl(const Impl&) = delete;
@@ -275,23 +2502,62 @@ struct Logger::Impl
     Impl(Impl&&) = delete;
     Impl& operator=(Impl&&) = delete;
 
-    std::string                     _category;
-    Priority                        _globalThreshold;
-    dests_t                         _dests;
-    priority_queue_t                _queue;
-
-    mutable std::mutex              _writeMutex;
-    std::condition_variable         _writeCond;
-    mutable std::mutex              _destMutex;
+    /// Per priority message counters of a group of threads.
+    struct Counters
+    {
+        using counter_t = std::array<std::atomic<std::uint64_t>, static_cast<size_t>(Priority::__Size)>;
+
+        counter_t                   _accepted{};
+        counter_t                   _rejected{};
+        counter_t                   _suppressed{};
+        /// Keeps the shards on different cache lines.
+        char                        _padding[64];
+    };
+    static const size_t shards = 16;
+
+    /// Relaxed increment of a counter in the shard of the calling thread,
+    /// the threads rarely share a shard so the cache line is not contended.
+    void count(Counters::counter_t Counters::* counter_, const Priority pri_) const
+    {
+        static std::atomic_size_t nextShard{0};
+        thread_local const size_t shard = nextShard.fetch_add(1, std::memory_order_relaxed) % shards;
+        (_counters[shard].*counter_)[static_cast<size_t>(pri_)].fetch_add(1, std::memory_order_relaxed);
+    }
 
-    std::thread                     _logger;
-    std::atomic_bool                _log{true};
+    LoggingEngine::ptr_t            _engine;
+    std::atomic<Priority>           _globalThreshold;
+    /// Copy of _dests->_floor which is cheaper to load.
+    std::atomic<Priority>           _destFloor{Priority::__Size};
+    /// Serializes the reconfigurations, readers never take it.
+    std::mutex                      _destMutex;
 
-    Priority                        _errorThreshold{MultiLogger::Priority::Error};
+    /// The RateLimit of every priority, the fields are loaded one by one.
+    struct AtomicRateLimit
+    {
+        std::atomic<std::uint32_t>  _perSecond{0};
+        std::atomic<std::uint32_t>  _burst{1};
+        std::atomic<std::uint32_t>  _everyNth{1};
+        std::atomic<double>         _probability{1.0};
+    };
+    std::array<AtomicRateLimit, static_cast<size_t>(Priority::__Size)> _rateLimits;
+
+    std::atomic<Priority>           _errorThreshold{MultiLogger::Priority::Error};
     std::atomic_size_t              _requestedErrors{0};
     verif_cb_t                      _verifCB;
 
-    std::chrono::seconds            _maxWait{1ul};
+    mutable std::array<Counters, shards> _counters;
+
+    /// A call site which suppressed messages since the last flush.
+    struct SuppressingSite
+    {
+        LogSite*        _site;
+        Priority        _priority;
+        const char*     _function;
+        const char*     _file;
+        int             _line;
+    };
+    mutable std::mutex                          _sitesMutex;
+    mutable std::vector<SuppressingSite>        _suppressingSites;
 };
 
 //=============================================================================
@@ -299,6 +2565,24 @@ struct Logger::Impl
 LogDest::~LogDest()
 {}
 
+void LogDest::layout(const std::string& pattern_)
+{
+    std::atomic_store(&_layout, layoutOf(pattern_));
+}
+
+std::string LogDest::layout() const
+{
+    const auto layout = std::atomic_load(&_layout);
+    return layout ? layout->pattern() : Layout::classic;
+}
+
+void LogDest::write(const LogLine* lines_, const size_t count_)
+{
+    for (auto i = size_t{0}; i < count_; ++i) {
+        write(std::string{lines_[i]._data, lines_[i]._size});
+    }
+}
+
 FileDest::FileDest(const std::string& fname_)
     : _file{fname_, std::ios_base::out}
 {
@@ -317,11 +2601,44 @@ void FileDest::write(const std::string& msg_)
     }
 }
 
+void FileDest::write(const LogLine* lines_, const size_t count_)
+{
+    for (auto i = size_t{0}; _file && i < count_; ++i) {
+        _file.write(lines_[i]._data, static_cast<std::streamsize>(lines_[i]._size));
+    }
+}
+
 void FileDest::flush()
 {
     _file.flush();
 }
 
+bool LogDest::jsonLines() const
+{
+    return false;
+}
+
+JsonFileDest::JsonFileDest(const std::string& fname_)
+    : FileDest{fname_}
+{
+    layout(Layout::json);
+}
+
+JsonFileDest::~JsonFileDest()
+{}
+
+void JsonFileDest::write(const std::string& msg_)
+{
+    std::stringbuf out;
+    appendJsonMessage(out, msg_.data(), msg_.size());
+    FileDest::write(out.str());
+}
+
+bool JsonFileDest::jsonLines() const
+{
+    return true;
+}
+
 StdOutDest::~StdOutDest()
 {}
 
@@ -330,6 +2647,13 @@ void StdOutDest::write(const std::string& msg_)
     std::cout << msg_;
 }
 
+void StdOutDest::write(const LogLine* lines_, const size_t count_)
+{
+    for (auto i = size_t{0}; i < count_; ++i) {
+        std::cout.write(lines_[i]._data, static_cast<std::streamsize>(lines_[i]._size));
+    }
+}
+
 void StdOutDest::flush()
 {
     std::cout.flush();
@@ -343,16 +2667,112 @@ void StdErrDest::write(const std::string& msg_)
     std::cerr << msg_;
 }
 
+void StdErrDest::write(const LogLine* lines_, const size_t count_)
+{
+    for (auto i = size_t{0}; i < count_; ++i) {
+        std::cerr.write(lines_[i]._data, static_cast<std::streamsize>(lines_[i]._size));
+    }
+}
+
 void StdErrDest::flush()
 {
     std::cerr.flush();
 }
 
+NullDest::~NullDest()
+{}
+
+void NullDest::write(const std::string&)
+{}
+
+void NullDest::write(const LogLine*, const size_t)
+{}
+
+void NullDest::flush()
+{}
+
+CountingDest::CountingDest(const bool checksum_)
+    : _checksum{checksum_}
+{}
+
+CountingDest::~CountingDest()
+{}
+
+void CountingDest::write(const std::string& msg_)
+{
+    count(msg_.data(), msg_.size());
+}
+
+void CountingDest::write(const LogLine* lines_, const size_t count_)
+{
+    for (auto i = size_t{0}; i < count_; ++i) {
+        count(lines_[i]._data, lines_[i]._size);
+    }
+}
+
+void CountingDest::flush()
+{}
+
+std::uint64_t CountingDest::lines() const
+{
+    return _lineCount.load(std::memory_order_relaxed);
+}
+
+std::uint64_t CountingDest::bytes() const
+{
+    return _byteCount.load(std::memory_order_relaxed);
+}
+
+std::uint64_t CountingDest::checksum() const
+{
+    return _hash.load(std::memory_order_relaxed);
+}
+
+/// Only the writer, holding the writer mutex, modifies the counters.
+void CountingDest::count(const char* data_, const size_t size_)
+{
+    _lineCount.store(_lineCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    _byteCount.store(_byteCount.load(std::memory_order_relaxed) + size_, std::memory_order_relaxed);
+    if (_checksum) {
+        const auto hash = _hash.load(std::memory_order_relaxed);
+        _hash.store((hash ^ hashBytes(data_, size_)) * 0x100000001b3ull, std::memory_order_relaxed);
+    }
+}
+
+//=============================================================================
+
+LoggingEngine::LoggingEngine()
+    : _pImpl{MultiLogger::cpp14::imp::make_unique<Impl>(cpp17::pmr::new_delete_resource())}
+{}
+
+LoggingEngine::LoggingEngine(cpp17::pmr::memory_resource* resource_)
+    : _pImpl{MultiLogger::cpp14::imp::make_unique<Impl>(resource_)}
+{}
+
+LoggingEngine::~LoggingEngine()
+{}
+
+void LoggingEngine::flush()
+{
+    _pImpl->flush();
+}
+
+bool LoggingEngine::flush(const std::chrono::milliseconds timeout_)
+{
+    return _pImpl->flush(timeout_);
+}
+
 //=============================================================================
 
 Logger::Logger(const Priority globalThreshold_
     , const std::string& category_)
-    : _pImpl{MultiLogger::cpp14::imp::make_unique<Impl>(globalThreshold_, category_)}
+    : _pImpl{MultiLogger::cpp14::imp::make_unique<Impl>(nullptr, globalThreshold_, category_)}
+{}
+
+Logger::Logger(const LoggingEngine::ptr_t& engine_
+    , const Priority globalThreshold_
+    , const std::string& category_)
+    : _pImpl{MultiLogger::cpp14::imp::make_unique<Impl>(engine_, globalThreshold_, category_)}
 {}
 
 Logger::~Logger()
@@ -365,7 +2785,59 @@ void Logger::operator()(std::string&& message_
     , int line_
     , const std::thread::id threadId_)
 {
-    _pImpl->log(std::move(message_), pri_, function_, file_, line_, threadId_);
+    _pImpl->log(message_.data(), message_.size(), LogLine{nullptr, 0}, pri_, function_, file_, line_, threadId_);
+}
+
+void Logger::operator()(const char* message_
+    , const size_t size_
+    , const Priority pri_
+    , const char* function_
+    , const char* file_
+    , int line_
+    , const std::thread::id threadId_)
+{
+    _pImpl->log(message_, size_, LogLine{nullptr, 0}, pri_, function_, file_, line_, threadId_);
+}
+
+void Logger::operator()(const char* message_
+    , const size_t size_
+    , const LogLine& fields_
+    , const Priority pri_
+    , const char* function_
+    , const char* file_
+    , int line_
+    , const std::thread::id threadId_)
+{
+    _pImpl->log(message_, size_, fields_, pri_, function_, file_, line_, threadId_);
+}
+
+void Logger::operator()(std::unique_ptr<DeferredText>&& text_
+    , const Priority pri_
+    , const char* function_
+    , const char* file_
+    , int line_
+    , const std::thread::id threadId_)
+{
+    _pImpl->log(std::move(text_), pri_, function_, file_, line_, threadId_);
+}
+
+bool Logger::accepts(const Priority pri_) const
+{
+    return _pImpl->accepts(pri_);
+}
+
+bool Logger::accepts(const Priority pri_
+    , LogSite& site_
+    , const char* function_
+    , const char* file_
+    , int line_) const
+{
+    return _pImpl->accepts(pri_, site_, function_, file_, line_);
+}
+
+void Logger::rateLimit(const Priority pri_, const RateLimit& limit_)
+{
+    _pImpl->rateLimit(pri_, limit_);
 }
 
 void Logger::category(const std::string& category_)
@@ -375,12 +2847,17 @@ void Logger::category(const std::string& category_)
 
 void Logger::addDest(const std::string& name_, LogDest::ptr_t&& dest_)
 {
-    _pImpl->addDest(name_, std::move(dest_));
+    _pImpl->addDest(name_, threshold(), LogDest::shared_ptr_t{std::move(dest_)});
 }
 
 void Logger::addDest(const std::string& name_, const Priority thresHold_, LogDest::ptr_t&& dest_)
 {
-    _pImpl->addDest(name_, thresHold_, std::move(dest_));
+    _pImpl->addDest(name_, thresHold_, LogDest::shared_ptr_t{std::move(dest_)});
+}
+
+void Logger::addSharedDest(const std::string& name_, const Priority thresHold_, const LogDest::shared_ptr_t& dest_)
+{
+    _pImpl->addDest(name_, thresHold_, dest_);
 }
 
 void Logger::permitDest(const std::string& name_, const bool enable_)
@@ -398,6 +2875,21 @@ void Logger::threshold(const std::string& destName_, const Priority threshold_)
     _pImpl->threshold(destName_, threshold_);
 }
 
+void Logger::flush()
+{
+    _pImpl->flush();
+}
+
+bool Logger::flush(const std::chrono::milliseconds timeout_)
+{
+    return _pImpl->flush(timeout_);
+}
+
+void Logger::dedup(const std::string& destName_, const std::chrono::milliseconds window_)
+{
+    _pImpl->dedup(destName_, window_);
+}
+
 void Logger::verifyCB(const verif_cb_t& cb_)
 {
     _pImpl->verifyCB(cb_);
@@ -408,11 +2900,16 @@ void Logger::errorThreshold(const Priority errorThreshold_)
     _pImpl->errorThreshold(errorThreshold_);
 }
 
-const std::string& Logger::category() const
+std::string Logger::category() const
 {
     return _pImpl->category();
 }
 
+Priority Logger::threshold() const
+{
+    return _pImpl->threshold();
+}
+
 Priority Logger::errorThreshold() const
 {
     return _pImpl->errorThreshold();
@@ -428,6 +2925,41 @@ bool Logger::logging(const std::string& destName_) const
     return _pImpl->logging(destName_);
 }
 
+LogStats Logger::stats() const
+{
+    return _pImpl->stats();
+}
+
+//=============================================================================
+
+void setThreadName(const std::string& name_)
+{
+    auto& slot = threadSlot();
+    slot._thread._text = ThreadRegistry::instance().name(slot._thread._index, name_);
+}
+
+//=============================================================================
+
+void ScopedContext::push(const char* fields_, const size_t size_)
+{
+    auto& current = currentContext();
+    std::string fields;
+    if (current) {
+        fields.reserve(current->_fields.size() + size_);
+        fields.append(current->_fields);
+    }
+    fields.append(fields_, size_);
+    _previous = current;
+    _context = ContextRegistry::instance().acquire(std::move(fields));
+    current = _context;
+}
+
+ScopedContext::~ScopedContext()
+{
+    currentContext() = _previous;
+    ContextRegistry::instance().release(_context);
+}
+
 //=============================================================================
 
 Logger& globalLogger()
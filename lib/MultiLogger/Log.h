@@ -2,9 +2,22 @@
 
 #include <memory>
 #include <string>
+#include <array>
+#include <vector>
 #include <thread>
+#include <chrono>
 #include <fstream>
 #include <functional>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <ostream>
+#include <streambuf>
+#include <locale>
+#include <type_traits>
 
 // C++11 backward-compatibility
 #ifdef _MSC_VER
@@ -17,6 +30,34 @@
 # endif
 #endif
 
+// std::pmr is used if available
+#if defined(_MSVC_LANG)
+# if (_MSVC_LANG >= 201703L)
+#  define USING_CPP17 1
+# endif
+#elif (__cplusplus >= 201703L) && defined(__has_include)
+# if __has_include(<memory_resource>)
+#  define USING_CPP17 1
+# endif
+#endif
+
+#ifdef USING_CPP17
+# include <memory_resource>
+# include <string_view>
+#endif
+
+// Bytes the MRLog* macros format a message into without allocating,
+// longer messages move to the heap. Multiple of the cache line size.
+#ifndef MULTILOGGER_INLINE_CAPACITY
+# define MULTILOGGER_INLINE_CAPACITY 256
+#endif
+
+// Bytes of the structured fields (see kv()) of a message kept without
+// allocating.
+#ifndef MULTILOGGER_FIELDS_CAPACITY
+# define MULTILOGGER_FIELDS_CAPACITY 128
+#endif
+
 namespace MultiLogger
 {
 
@@ -39,6 +80,46 @@ std::unique_ptr<T> make_unique(Ts&&... params_)
 }
 #endif
 
+#ifdef USING_CPP17
+namespace cpp17
+{ namespace pmr = std::pmr; }
+#else
+namespace cpp17
+{
+namespace pmr
+{
+/// The interface of std::pmr::memory_resource for the compilers without it.
+class memory_resource
+{
+public:
+    virtual ~memory_resource()
+    {}
+
+    void* allocate(const size_t bytes_, const size_t alignment_ = alignof(std::max_align_t))
+    {
+        return do_allocate(bytes_, alignment_);
+    }
+    void deallocate(void* p_, const size_t bytes_, const size_t alignment_ = alignof(std::max_align_t))
+    {
+        do_deallocate(p_, bytes_, alignment_);
+    }
+    bool is_equal(const memory_resource& other_) const noexcept
+    {
+        return do_is_equal(other_);
+    }
+
+private:
+    virtual void* do_allocate(size_t bytes_, size_t alignment_) = 0;
+    virtual void do_deallocate(void* p_, size_t bytes_, size_t alignment_) = 0;
+    virtual bool do_is_equal(const memory_resource& other_) const noexcept = 0;
+};
+
+/// @return the resource using the global operator new and delete
+memory_resource* new_delete_resource() noexcept;
+}
+}
+#endif
+
 enum class Priority
 {
     Debug,
@@ -64,9 +145,693 @@ Ostream& operator<<(Ostream& lhs_, const Priority rhs_)
 
 //=============================================================================
 
+/**
+ * Limits how many messages a call site of the MRLog* macros may log.
+ * 
+ * The limits can be combined, a message has to pass all of them:
+ *   * <i>perSecond</i>: token bucket allowing this many messages per second
+ *     on average and at most <i>burst</i> messages at once, 0 means no limit
+ *   * <i>everyNth</i>: only every Nth call is logged, 0 and 1 mean every call
+ *   * <i>probability</i>: every call is logged with this probability
+ *   .
+ */
+struct RateLimit
+{
+    constexpr RateLimit(const std::uint32_t perSecond_ = 0
+        , const std::uint32_t burst_ = 1
+        , const std::uint32_t everyNth_ = 1
+        , const double probability_ = 1.0)
+        : _perSecond{perSecond_}
+        , _burst{burst_}
+        , _everyNth{everyNth_}
+        , _probability{probability_}
+    {}
+
+    static constexpr RateLimit perSecond(const std::uint32_t perSecond_, const std::uint32_t burst_ = 1)
+    {
+        return RateLimit{perSecond_, burst_};
+    }
+
+    static constexpr RateLimit everyNth(const std::uint32_t everyNth_)
+    {
+        return RateLimit{0, 1, everyNth_};
+    }
+
+    static constexpr RateLimit sampled(const double probability_)
+    {
+        return RateLimit{0, 1, 1, probability_};
+    }
+
+    /// @return true if every message passes
+    constexpr bool unlimited() const
+    {
+        return _perSecond == 0 && _everyNth <= 1 && !(_probability < 1.0);
+    }
+
+    std::uint32_t       _perSecond;
+    std::uint32_t       _burst;
+    std::uint32_t       _everyNth;
+    double              _probability;
+};
+
+/// The number of messages suppressed at a call site since its last
+/// logged message. Streamed at the end of that message if not zero.
+/// The count of a site which stops logging is logged as a message of its
+/// own by Logger::flush() and when the Logger is destroyed.
+struct Suppressed
+{
+    std::uint64_t       _count;
+};
+
+template <class Ostream>
+Ostream& operator<<(Ostream& lhs_, const Suppressed& rhs_)
+{
+    if (rhs_._count != 0) {
+        lhs_ << " (" << rhs_._count << " similar messages suppressed)";
+    }
+    return lhs_;
+}
+
+/**
+ * The state of a single call site of the MRLog* macros.
+ * 
+ * Every macro invocation has its own static, constant initialized LogSite.
+ * It applies either its own RateLimit or the one its Logger sets for the
+ * priority, using only atomics of the site itself.
+ */
+class LogSite
+{
+public:
+    /// A site following the limits of its Logger.
+    constexpr LogSite()
+        : _limit{}
+        , _own{false}
+    {}
+    /// A site with its own limit.
+    constexpr explicit LogSite(const RateLimit& limit_)
+        : _limit{limit_}
+        , _own{true}
+    {}
+
+    /// @return true if a message may be logged from this site
+    bool admit(const RateLimit& loggerLimit_);
+    /// Take the number of suppressed messages since the last call.
+    Suppressed suppressed()
+    {
+        return Suppressed{(_suppressed.load(std::memory_order_relaxed) == 0)
+            ? 0 : _suppressed.exchange(0, std::memory_order_relaxed)};
+    }
+
+    LogSite(const LogSite&) = delete;
+    LogSite& operator=(const LogSite&) = delete;
+
+private:
+    friend class Logger;
+    const RateLimit                 _limit;
+    const bool                      _own;
+    std::atomic<std::uint64_t>      _calls{0};
+    /// Theoretical arrival time of the next message in the token bucket.
+    std::atomic<std::int64_t>       _nextTime{0};
+    std::atomic<std::uint64_t>      _suppressed{0};
+    /// Set while a Logger has the site on its list of sites to report at
+    /// the next flush.
+    std::atomic<bool>               _listed{false};
+};
+
+//=============================================================================
+
 /// @todo Add rolling file destination.
 /// @todo Add compressed file destination.
 
+/// A non-owning view of a complete, formatted log line
+/// in a buffer of the backend.
+struct LogLine
+{
+    const char*         _data;
+    size_t              _size;
+};
+
+/**
+ * Stream buffer writing into an array of Capacity bytes, it moves to the
+ * heap only if the message does not fit.
+ */
+template <size_t Capacity>
+class InlineBuffer : public std::streambuf
+{
+    static_assert(Capacity > 0, "the inline capacity must not be 0");
+
+public:
+    InlineBuffer()
+    {
+        setp(_inline, _inline + Capacity);
+    }
+
+    const char* data() const
+    {
+        return pbase();
+    }
+
+    size_t size() const
+    {
+        return static_cast<size_t>(pptr() - pbase());
+    }
+
+    InlineBuffer(const InlineBuffer&) = delete;
+    InlineBuffer& operator=(const InlineBuffer&) = delete;
+
+protected:
+    int_type overflow(const int_type ch_) override
+    {
+        if (traits_type::eq_int_type(ch_, traits_type::eof())) {
+            return traits_type::not_eof(ch_);
+        }
+        const auto used = size();
+        std::string grown(2 * (used < Capacity ? Capacity : used), '\0');
+        grown.replace(0, used, pbase(), used);
+        _spill.swap(grown);
+        setp(&_spill[0], &_spill[0] + _spill.size());
+        pbump(static_cast<int>(used));
+        *pptr() = traits_type::to_char_type(ch_);
+        pbump(1);
+        return ch_;
+    }
+
+private:
+    char                _inline[Capacity];
+    std::string         _spill;
+};
+
+namespace imp
+{
+/// Constructs the buffer before the stream using it.
+template <size_t Capacity>
+struct InlineBufferHolder
+{
+    InlineBuffer<Capacity>  _buffer;
+};
+
+/**
+ * @return the classic locale formatting the integers and the floating-point
+ * numbers with std::to_chars (where available) instead of the locale facets
+ */
+const std::locale& numericLocale();
+
+/// The types of the values of the structured fields.
+enum class FieldType : char
+{
+    Bool = 'b',
+    Signed = 'i',
+    Unsigned = 'u',
+    Double = 'd',
+    String = 's'
+};
+
+/**
+ * The structured fields of a message, encoded one after the other as the
+ * FieldType, the size of the key, the key and the value: the bytes of the
+ * bool or the number, or the 4 byte size and the bytes of the string.
+ * Keys longer than 255 bytes are cut.
+ */
+class Fields
+{
+public:
+    Fields() = default;
+
+    void add(const char* key_, const bool value_)
+    {
+        put(FieldType::Bool, key_, &value_, sizeof(value_));
+    }
+    void add(const char* key_, const std::int64_t value_)
+    {
+        put(FieldType::Signed, key_, &value_, sizeof(value_));
+    }
+    void add(const char* key_, const std::uint64_t value_)
+    {
+        put(FieldType::Unsigned, key_, &value_, sizeof(value_));
+    }
+    void add(const char* key_, const double value_)
+    {
+        put(FieldType::Double, key_, &value_, sizeof(value_));
+    }
+    void add(const char* key_, const char* value_, const size_t size_)
+    {
+        const auto size = static_cast<std::uint32_t>(size_);
+        put(FieldType::String, key_, &size, sizeof(size));
+        append(value_, size);
+    }
+
+    const char* data() const
+    {
+        return _spill.empty() ? _inline : _spill.data();
+    }
+
+    size_t size() const
+    {
+        return _size;
+    }
+
+    Fields(const Fields&) = delete;
+    Fields& operator=(const Fields&) = delete;
+
+private:
+    void put(const FieldType type_, const char* key_, const void* value_, const size_t size_)
+    {
+        const char header[] = {static_cast<char>(type_)
+            , static_cast<char>(static_cast<unsigned char>(std::min<size_t>(std::strlen(key_), 255)))};
+        append(header, sizeof(header));
+        append(key_, static_cast<unsigned char>(header[1]));
+        append(value_, size_);
+    }
+
+    void append(const void* data_, const size_t size_)
+    {
+        if (_spill.empty() && (_size + size_ <= sizeof(_inline))) {
+            std::memcpy(_inline + _size, data_, size_);
+        } else {
+            if (_spill.empty()) {
+                _spill.assign(_inline, _size);
+            }
+            _spill.append(static_cast<const char*>(data_), size_);
+        }
+        _size += size_;
+    }
+
+    char                _inline[MULTILOGGER_FIELDS_CAPACITY];
+    std::string         _spill;
+    size_t              _size = 0;
+};
+
+/// The index of the std::ios_base::pword() of the LogStreams pointing to
+/// their Fields.
+int fieldsIndex();
+}
+
+/**
+ * The stream the MRLog* macros format the messages with.
+ * It uses imp::numericLocale(), so the output does not depend on the global
+ * locale and numbers in the default format skip the locale facets.
+ */
+template <size_t Capacity = MULTILOGGER_INLINE_CAPACITY>
+class LogStream : private imp::InlineBufferHolder<Capacity>, public std::ostream
+{
+public:
+    LogStream()
+        : std::ostream{&this->_buffer}
+    {
+        imbue(imp::numericLocale());
+        pword(imp::fieldsIndex()) = &_fields;
+    }
+
+    const char* data() const
+    {
+        return this->_buffer.data();
+    }
+
+    size_t size() const
+    {
+        return this->_buffer.size();
+    }
+
+    /// @return the encoded structured fields streamed with kv()
+    LogLine fields() const
+    {
+        return LogLine{_fields.data(), _fields.size()};
+    }
+
+private:
+    imp::Fields     _fields;
+};
+
+namespace imp
+{
+
+template <class T>
+struct KeyValue
+{
+    const char*     _key;
+    const T&        _value;
+};
+
+inline void addField(Fields& fields_, const char* key_, const bool value_)
+{
+    fields_.add(key_, value_);
+}
+
+inline void addField(Fields& fields_, const char* key_, const char value_)
+{
+    fields_.add(key_, &value_, 1);
+}
+
+inline void addField(Fields& fields_, const char* key_, const char* value_)
+{
+    fields_.add(key_, value_, std::strlen(value_));
+}
+
+inline void addField(Fields& fields_, const char* key_, const std::string& value_)
+{
+    fields_.add(key_, value_.data(), value_.size());
+}
+
+#ifdef USING_CPP17
+inline void addField(Fields& fields_, const char* key_, const std::string_view value_)
+{
+    fields_.add(key_, value_.data(), value_.size());
+}
+#endif
+
+template <class T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value && !std::is_same<T, char>::value>::type
+addField(Fields& fields_, const char* key_, const T& value_)
+{
+    fields_.add(key_, static_cast<std::int64_t>(value_));
+}
+
+template <class T>
+typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value && !std::is_same<T, bool>::value>::type
+addField(Fields& fields_, const char* key_, const T& value_)
+{
+    fields_.add(key_, static_cast<std::uint64_t>(value_));
+}
+
+template <class T>
+typename std::enable_if<std::is_floating_point<T>::value>::type
+addField(Fields& fields_, const char* key_, const T& value_)
+{
+    fields_.add(key_, static_cast<double>(value_));
+}
+
+/// Any other value is kept as its text.
+template <class T>
+typename std::enable_if<!std::is_arithmetic<T>::value
+    && !std::is_convertible<const T&, const char*>::value
+    && !std::is_convertible<const T&, std::string>::value>::type
+addField(Fields& fields_, const char* key_, const T& value_)
+{
+    LogStream<64> text;
+    text << value_;
+    fields_.add(key_, text.data(), text.size());
+}
+
+template <class T>
+std::ostream& operator<<(std::ostream& out_, const KeyValue<T>& field_)
+{
+    if (const auto fields = static_cast<Fields*>(out_.pword(fieldsIndex()))) {
+        addField(*fields, field_._key, field_._value);
+    } else {
+        out_ << field_._key << '=' << field_._value;
+    }
+    return out_;
+}
+
+}
+
+/**
+ * A structured field of a message, e.g.
+ * MRLogInfoL(log, "login" << MultiLogger::kv("user", name) << MultiLogger::kv("age", age));
+ * The MRLog* macros keep the fields typed: text layouts append them to the
+ * message as key=value, JSON layouts write them as members. Other streams,
+ * e.g. the ones of MRLogDeferredL, get key=value in place.
+ */
+template <class T>
+imp::KeyValue<T> kv(const char* key_, const T& value_)
+{
+    return imp::KeyValue<T>{key_, value_};
+}
+
+//=============================================================================
+
+#ifdef USING_CPP14
+namespace imp
+{
+
+/// A literal text or an argument ({}) of a format string.
+struct FormatPiece
+{
+    size_t  _begin;
+    size_t  _size;
+    bool    _slot;
+};
+
+/// Number of pieces and arguments of a format string.
+struct FormatShape
+{
+    size_t  _pieces;
+    size_t  _slots;
+    bool    _valid;
+};
+
+/**
+ * Parse a format string of MRLogf at compile time. Every {} is an argument,
+ * {{ and }} stand for { and }, any other brace makes the format invalid.
+ */
+constexpr FormatShape formatShape(const char* format_)
+{
+    FormatShape shape{0, 0, true};
+    auto literal = false;
+    for (auto i = size_t{0}; format_[i] != '\0'; ) {
+        const auto c = format_[i];
+        if ((c == '{' || c == '}') && (format_[i + 1] == c)) {
+            ++shape._pieces;
+            literal = false;
+            i += 2;
+        } else if ((c == '{') && (format_[i + 1] == '}')) {
+            ++shape._pieces;
+            ++shape._slots;
+            literal = false;
+            i += 2;
+        } else if (c == '{' || c == '}') {
+            shape._valid = false;
+            return shape;
+        } else {
+            shape._pieces += literal ? 0 : 1;
+            literal = true;
+            ++i;
+        }
+    }
+    return shape;
+}
+
+/// The pieces of a format string, computed by compileFormat().
+template <size_t Pieces>
+struct CompiledFormat
+{
+    FormatPiece _pieces[Pieces == 0 ? 1 : Pieces];
+};
+
+template <size_t Pieces>
+constexpr CompiledFormat<Pieces> compileFormat(const char* format_)
+{
+    CompiledFormat<Pieces> compiled{};
+    auto piece = size_t{0};
+    auto literal = false;
+    for (auto i = size_t{0}; format_[i] != '\0'; ) {
+        const auto c = format_[i];
+        if ((c == '{' || c == '}') && (format_[i + 1] == c)) {
+            compiled._pieces[piece++] = FormatPiece{i, 1, false};
+            literal = false;
+            i += 2;
+        } else if (c == '{') {
+            compiled._pieces[piece++] = FormatPiece{i, 0, true};
+            literal = false;
+            i += 2;
+        } else {
+            if (!literal) {
+                compiled._pieces[piece++] = FormatPiece{i, 0, false};
+                literal = true;
+            }
+            ++compiled._pieces[piece - 1]._size;
+            ++i;
+        }
+    }
+    return compiled;
+}
+
+/// Only its type is used, to count the arguments after the format string.
+template <size_t N, class... Args>
+std::integral_constant<size_t, sizeof...(Args)> formatArguments(const char (&format_)[N], const Args&... args_);
+
+using format_writer_t = void (*)(std::ostream& out_, const void* arg_);
+
+template <class T>
+void writeArgument(std::ostream& out_, const void* arg_)
+{
+    out_ << *static_cast<const T*>(arg_);
+}
+
+/**
+ * Write the literals of the compiled format and the arguments in its slots.
+ * The writers of the slots are chosen by the types of the arguments at
+ * compile time, nothing is parsed here.
+ */
+template <size_t Pieces, size_t N, class... Args>
+void renderFormat(std::ostream& out_
+    , const CompiledFormat<Pieces>& compiled_
+    , const char (&format_)[N]
+    , const Args&... args_)
+{
+    const void* const arguments[] = {nullptr, &args_...};
+    const format_writer_t writers[] = {nullptr, &writeArgument<Args>...};
+    auto slot = size_t{1};
+    for (auto i = size_t{0}; i < Pieces; ++i) {
+        const auto& piece = compiled_._pieces[i];
+        if (piece._slot) {
+            writers[slot](out_, arguments[slot]);
+            ++slot;
+        } else {
+            out_.write(format_ + piece._begin, static_cast<std::streamsize>(piece._size));
+        }
+    }
+}
+
+}
+#endif
+
+//=============================================================================
+
+/**
+ * The text of a message rendered by the backend thread of the engine,
+ * created by the MRLogDeferred* macros.
+ */
+class DeferredText
+{
+public:
+    virtual ~DeferredText() = default;
+    /// Called once by the backend thread.
+    virtual void write(std::ostream& out_) const = 0;
+};
+
+namespace imp
+{
+
+template <class Writer>
+class DeferredWriter : public DeferredText
+{
+public:
+    explicit DeferredWriter(Writer&& writer_)
+        : _writer{std::move(writer_)}
+    {}
+
+    void write(std::ostream& out_) const override
+    {
+        _writer(out_);
+    }
+
+private:
+    Writer  _writer;
+};
+
+template <class Function>
+struct Lazy
+{
+    Function    _function;
+};
+
+template <class Ostream, class Function>
+Ostream& operator<<(Ostream& lhs_, const Lazy<Function>& rhs_)
+{
+    lhs_ << rhs_._function();
+    return lhs_;
+}
+
+}
+
+/// @return the text calling writer_(std::ostream&) on the backend thread
+template <class Writer>
+std::unique_ptr<DeferredText> deferred(Writer writer_)
+{
+    return std::unique_ptr<DeferredText>{new imp::DeferredWriter<Writer>{std::move(writer_)}};
+}
+
+/**
+ * Stream the result of function_() only if the message is logged, e.g.
+ * MRLogDebugL(log, "cache: " << MultiLogger::lazy([&cache]() { return cache.dump(); }));
+ * With MRLogDeferredL it is called on the backend thread.
+ */
+template <class Function>
+imp::Lazy<typename std::decay<Function>::type> lazy(Function&& function_)
+{
+    return imp::Lazy<typename std::decay<Function>::type>{std::forward<Function>(function_)};
+}
+
+//=============================================================================
+
+/**
+ * The layout of the lines of a destination, compiled once from a pattern.
+ * The fields of the pattern:
+ *   * %d: the time, e.g. Oct 18 08:37:08.719369453
+ *   * %t: the thread (see setThreadName())
+ *   * %c: the category of the Logger
+ *   * %f: the function
+ *   * %p: the priority
+ *   * %m: the message
+ *   * %F: the source file
+ *   * %L: the line in the source file
+ *   * %j: the message as a JSON object, with the fields of its context and its
+ *     structured fields (see kv())
+ *   * %%: a percent sign
+ *   .
+ * Every other character is copied and every line ends with a new line.
+ * The message (%m) is followed by the fields of its context (see ScopedContext)
+ * and its structured fields as key=value.
+ */
+class Layout
+{
+public:
+    /// The layout of the destinations without a layout of their own.
+    static const char* const classic;
+    /// A JSON object per line, see JsonFileDest.
+    static const char* const json;
+
+    enum class Field : std::uint8_t
+    {
+        Literal,
+        Time,
+        Thread,
+        Category,
+        Function,
+        Priority,
+        Message,
+        File,
+        Line,
+        Json
+    };
+
+    /// A step of rendering a line, the literals are in literals().
+    struct Op
+    {
+        Field               _field;
+        std::uint32_t       _begin;
+        std::uint32_t       _size;
+    };
+
+    /// @throw std::runtime_error if the pattern has an unknown field
+    explicit Layout(const std::string& pattern_);
+
+    const std::string& pattern() const
+    {
+        return _pattern;
+    }
+    const std::vector<Op>& ops() const
+    {
+        return _ops;
+    }
+    const std::string& literals() const
+    {
+        return _literals;
+    }
+    /// @return true for the classic layout, which has a fixed rendering
+    bool isClassic() const
+    {
+        return _classic;
+    }
+
+private:
+    std::string         _pattern;
+    std::string         _literals;
+    std::vector<Op>     _ops;
+    bool                _classic;
+};
+
 /**
  * This abstract class makes the Logger able to
  * log messages to arbitrary targets.<br/>
@@ -81,10 +846,45 @@ Ostream& operator<<(Ostream& lhs_, const Priority rhs_)
 struct LogDest
 {
     using ptr_t = std::unique_ptr<LogDest>;
+    /// A destination can be added to several Loggers, e.g. to let them
+    /// write the same file. Their messages are merged chronologically if
+    /// the Loggers share their LoggingEngine.
+    using shared_ptr_t = std::shared_ptr<LogDest>;
 
     virtual ~LogDest();
     virtual void write(const std::string&) = 0;
+    /// Write a batch of lines in the given order. The backend calls this once
+    /// per batch and destination. The default implementation calls write()
+    /// for every line, override it to avoid copying the lines into strings.
+    virtual void write(const LogLine* lines_, const size_t count_);
     virtual void flush() = 0;
+
+    /// Set the Layout of the lines. It takes effect when the destination is
+    /// added to a Logger, the destinations with the same pattern share the
+    /// rendered lines.
+    /// @throw std::runtime_error if the pattern is invalid
+    void layout(const std::string& pattern_);
+    /// @return the pattern of the Layout of the lines
+    std::string layout() const;
+
+protected:
+    /// @return true if every line has to be a JSON object, the lines of
+    ///         another layout are then written as the message of one
+    virtual bool jsonLines() const;
+
+private:
+    friend class LoggingEngine;
+    friend class Logger;
+    /// nullptr for the classic layout.
+    std::shared_ptr<const Layout>   _layout;
+    /// Held by the backend while it writes or flushes this destination so
+    /// the engines sharing it cannot interleave their lines.
+    std::mutex                      _writerMutex;
+    /// Statistics updated by the backends.
+    std::atomic<std::uint64_t>      _lines{0};
+    std::atomic<std::uint64_t>      _bytes{0};
+    std::atomic<std::uint64_t>      _writeNanos{0};
+    std::atomic<std::uint64_t>      _deduplicated{0};
 };
 
 /// Log to a file.
@@ -94,16 +894,36 @@ struct FileDest : public LogDest
     FileDest(const std::string& fname_);
     ~FileDest() override;
     void write(const std::string& msg_) override;
+    void write(const LogLine* lines_, const size_t count_) override;
     void flush() override;
 private:
     std::fstream        _file;
 };
 
+/**
+ * Log to a file a JSON object per line (JSON Lines) with the members time,
+ * priority, category, thread, function, file, line, message and the
+ * structured fields of the message (see kv()).
+ * The lines of another layout, as it was when the destination was added,
+ * and the texts written directly become the message of an object of their
+ * own, so every line stays a JSON object.
+ */
+struct JsonFileDest : public FileDest
+{
+    explicit JsonFileDest(const std::string& fname_);
+    ~JsonFileDest() override;
+    void write(const std::string& msg_) override;
+
+protected:
+    bool jsonLines() const override;
+};
+
 /// Log to stdout.
 struct StdOutDest : public LogDest
 {
     ~StdOutDest() override;
     void write(const std::string& msg_) override;
+    void write(const LogLine* lines_, const size_t count_) override;
     void flush() override;
 };
 
@@ -112,13 +932,153 @@ struct StdErrDest : public LogDest
 {
     ~StdErrDest() override;
     void write(const std::string& msg_) override;
+    void write(const LogLine* lines_, const size_t count_) override;
+    void flush() override;
+};
+
+/// Discard every message. Useful to measure the Logger without any I/O.
+struct NullDest : public LogDest
+{
+    ~NullDest() override;
+    void write(const std::string& msg_) override;
+    void write(const LogLine* lines_, const size_t count_) override;
     void flush() override;
 };
 
+/**
+ * Count the written lines and bytes without storing them.
+ * 
+ * With the checksum enabled an order dependent hash of the lines is kept
+ * as well, so two runs can be compared without writing any files.
+ * The counters may be read while the destination is written.
+ */
+struct CountingDest : public LogDest
+{
+    explicit CountingDest(const bool checksum_ = false);
+    ~CountingDest() override;
+    void write(const std::string& msg_) override;
+    void write(const LogLine* lines_, const size_t count_) override;
+    void flush() override;
+
+    std::uint64_t lines() const;
+    std::uint64_t bytes() const;
+    /// @return the hash of the written lines, 0 if the checksum is disabled
+    std::uint64_t checksum() const;
+
+private:
+    void count(const char* data_, const size_t size_);
+
+    const bool                      _checksum;
+    std::atomic<std::uint64_t>      _lineCount{0};
+    std::atomic<std::uint64_t>      _byteCount{0};
+    std::atomic<std::uint64_t>      _hash{0};
+};
+
 //=============================================================================
 
 using verif_cb_t = std::function<void(const size_t)>;
 
+/**
+ * Log-linear histogram of latencies in nanoseconds, similar to HdrHistogram.
+ * 
+ * Every power of two range is split into <i>subBuckets</i> equal buckets so
+ * the values are stored with less than 12.5% relative error, while the whole
+ * 64 bit range fits into a few hundred counters.
+ */
+struct LatencyHistogram
+{
+    static const size_t subBuckets = 8;
+    static const size_t buckets = 62 * subBuckets;
+
+    /// @return the index of the bucket counting the value
+    static size_t bucketOf(const std::uint64_t nanos_);
+    /// @return the highest value counted by the bucket
+    static std::uint64_t highestOf(const size_t bucket_);
+
+    /// @return the value below or at which the specified fraction (0.0 - 1.0)
+    ///         of the recorded values are
+    std::uint64_t percentile(const double fraction_) const;
+
+    std::array<std::uint64_t, buckets>  _counts;
+    std::uint64_t                       _count;
+    std::uint64_t                       _max;
+};
+
+/// Snapshot of the statistics of a Logger, see Logger::stats().
+struct LogStats
+{
+    using counters_t = std::array<std::uint64_t, static_cast<size_t>(Priority::__Size)>;
+
+    struct Dest
+    {
+        std::string                 _name;
+        /// Lines and bytes written to the destination, by every Logger sharing it.
+        std::uint64_t               _lines;
+        std::uint64_t               _bytes;
+        /// Time spent in the write calls of the destination.
+        std::chrono::nanoseconds    _writeTime;
+        /// Repeated lines dropped by the deduplication.
+        std::uint64_t               _deduplicated;
+    };
+
+    /// Messages per priority handed over to the engine.
+    counters_t                      _accepted;
+    /// Messages per priority below the thresholds of every destination.
+    counters_t                      _rejected;
+    /// Messages per priority dropped by rate limits.
+    counters_t                      _suppressed;
+    /// Messages in the engine not written yet, by every attached Logger.
+    std::uint64_t                   _queueDepth;
+    std::uint64_t                   _peakQueueDepth;
+    /// Memory reserved by the engine for the texts of the queued messages.
+    std::uint64_t                   _arenaBytes;
+    /// Time between logging a message and handing it over to the destinations.
+    LatencyHistogram                _latency;
+    std::vector<Dest>               _dests;
+};
+
+/**
+ * The backend which writes the messages of the Loggers attached to it.
+ * 
+ * Every Logger is attached to an engine. By default a Logger creates its
+ * own, but any number of Loggers (each with its own category, thresholds
+ * and destinations) can share one. A single backend thread serves all of
+ * them, so the messages of the attached Loggers are written in chronological
+ * order even across Loggers. Processes with many Loggers can spread them
+ * over a few engines if one backend thread is not enough.
+ * 
+ * The memory of the queued messages, the queues and the formatting buffers
+ * of the backend comes from a memory resource, by default from
+ * new_delete_resource(). The configuration of the Loggers, which rarely
+ * changes, is allocated with the global operator new.
+ */
+class LoggingEngine
+{
+    friend class Logger;
+    struct Impl;
+    std::unique_ptr<Impl> _pImpl;
+public:
+    using ptr_t = std::shared_ptr<LoggingEngine>;
+
+    LoggingEngine();
+    /// Create an engine allocating from the resource, which has to outlive it.
+    explicit LoggingEngine(cpp17::pmr::memory_resource* resource_);
+    /// Writes every pending message before it returns.
+    ~LoggingEngine();
+
+    /// Block until every message logged through the attached Loggers
+    /// before this call is written and their destinations are flushed.
+    void flush();
+    /// Same as flush() but gives up after the specified time.
+    /// @return true if everything was written and flushed in time
+    bool flush(const std::chrono::milliseconds timeout_);
+
+    LoggingEngine(const LoggingEngine&) = delete;
+    LoggingEngine& operator=(const LoggingEngine&) = delete;
+    LoggingEngine(LoggingEngine&&) = delete;
+    LoggingEngine& operator=(LoggingEngine&&) = delete;
+};
+
 /**
  * @mainpage
  * 
@@ -141,7 +1101,8 @@ using verif_cb_t = std::function<void(const size_t)>;
  *   * <i>Critical</i>
  *   .
  * If the threshold is <i>Info</i> and we try to log a <i>Debug</i> message
- * it won't be logged.
+ * it won't be logged. The same applies if none of the enabled destinations
+ * would write the message; in both cases the message is not even formatted.
  * 
  * Each Logger has its own category, so they can be differentiated
  * from the log. This is important because this Logger library is not a
@@ -164,6 +1125,21 @@ using verif_cb_t = std::function<void(const size_t)>;
  * The Logger uses standard library only so it should compile fine on other
  * platforms as well.
  * 
+ * The macros format the messages on the stack, into a buffer of
+ * MULTILOGGER_INLINE_CAPACITY (256) bytes by default, only longer messages
+ * need a heap allocation. Define it to a different multiple of the cache line
+ * size to trade stack usage for fewer allocations, the format_inline stages
+ * of LogBenchmark show the difference.
+ * 
+ * The macros log only the base name of the source files by default, trimmed
+ * at compile time. Define MULTILOGGER_FILE_STYLE to MULTILOGGER_FILE_FULL for
+ * the full __FILE__, or to MULTILOGGER_FILE_RELATIVE and MULTILOGGER_SOURCE_ROOT
+ * to the root of your sources for the paths relative to it. Functions keep
+ * their innermost scope, the class of a member function, if the compiler
+ * puts scopes into __FUNCTION__. Define MULTILOGGER_FUNCTION_STYLE to
+ * MULTILOGGER_FUNCTION_NAME to drop every scope, or to
+ * MULTILOGGER_FUNCTION_FULL to keep all of them.
+ * 
  * @section examples_sec Examples
  *
  * ### Log an info level message using the global logger with its default settings:
@@ -200,11 +1176,106 @@ using verif_cb_t = std::function<void(const size_t)>;
  debugger.addDest("stdout", std::make_unique<MultiLogger::StdOutDest>());
  @endcode
  * 
+ * ### Choose the layout of the lines of a destination:
+ * 
+ @code
+ auto console = std::make_shared<MultiLogger::StdOutDest>();
+ // the destinations with the same pattern share the rendered lines
+ console->layout("%p: %m");
+ debugger.addDest("console", console);
+ @endcode
+ * 
+ * ### Attach structured fields to a message:
+ * 
+ @code
+ debugger.addDest("json", std::make_shared<MultiLogger::JsonFileDest>("out.jsonl"));
+ MRLogInfoL(debugger, "login" << MultiLogger::kv("user", name) << MultiLogger::kv("age", age));
+ @endcode
+ * 
+ * ### Attach fields to every message of a scope:
+ * 
+ @code
+ MultiLogger::ScopedContext request{MultiLogger::kv("request", id), MultiLogger::kv("tenant", tenant)};
+ MRLogInfoL(debugger, "accepted"); // ... accepted request=42 tenant=acme (...)
+ @endcode
+ * 
+ * ### Serve many Loggers with a single backend thread:
+ * 
+ @code
+ auto engine = std::make_shared<MultiLogger::LoggingEngine>();
+ MultiLogger::Logger network{engine, MultiLogger::Priority::Info, "network"};
+ MultiLogger::Logger storage{engine, MultiLogger::Priority::Debug, "storage"};
+ @endcode
+ * 
+ * ### Keep expensive diagnostics in the code at no cost when they are not logged:
+ * 
+ @code
+ // dump() runs only if a destination accepts Debug messages
+ MRLogDebugL(debugger, "cache: " << MultiLogger::lazy([&cache]() { return cache.dump(); }));
+ // dump() runs on the backend thread, the shared_ptr keeps the cache alive
+ MRLogDeferredL(debugger, MultiLogger::Priority::Debug, "cache: " << MultiLogger::lazy([sharedCache]() { return sharedCache->dump(); }));
+ @endcode
+ * 
+ * ### Use a format string checked at compile time (C++14):
+ * 
+ @code
+ MRLogf(debugger, MultiLogger::Priority::Info, "user {} age {}", name, age);
+ // a wrong number of arguments or a stray brace does not compile
+ MRLogfG(MultiLogger::Priority::Warning, "{{{}}} left", remaining);
+ @endcode
+ * 
+ * ### Take the memory of the queued messages from your own memory resource:
+ * 
+ @code
+ // std::pmr::memory_resource with C++17, MultiLogger::cpp17::pmr::memory_resource before
+ auto engine = std::make_shared<MultiLogger::LoggingEngine>(&hugePageResource);
+ @endcode
+ * 
+ * ### Write the messages of several Loggers into the same file:
+ * 
+ @code
+ auto appLog = std::make_shared<MultiLogger::FileDest>("app.log");
+ network.addDest("app.log", appLog);
+ storage.addDest("app.log", appLog);
+ @endcode
+ * 
+ * ### Limit how often a call site may log:
+ * 
+ @code
+ // at most 10 messages per second from this line, with bursts of 100
+ MRLogLimitL(debugger, MultiLogger::Priority::Warning, MultiLogger::RateLimit::perSecond(10, 100), "queue full");
+ // every Debug call site without its own limit logs only every 1000th message
+ debugger.rateLimit(MultiLogger::Priority::Debug, MultiLogger::RateLimit::everyNth(1000));
+ @endcode
+ * The suppressed messages are counted per call site and the next logged
+ * message of the site reports how many were suppressed since the previous one.
+ * The counts no later message reported are logged by flush() and when the
+ * Logger is destroyed.
+ * 
+ * ### Make sure everything logged so far reached the destinations:
+ * 
+ @code
+ debugger.flush();
+ // or wait at most half a second
+ const bool done = debugger.flush(std::chrono::milliseconds{500});
+ @endcode
+ * 
+ * ### Check what the Logger is doing:
+ * 
+ @code
+ const auto stats = debugger.stats();
+ std::cout << "dropped warnings: " << stats._suppressed[static_cast<size_t>(MultiLogger::Priority::Warning)]
+     << " p99 latency: " << stats._latency.percentile(0.99) << " ns\n";
+ @endcode
+ * 
  * @section test_sec Tests
  * 
  * To try out and verify the library a @ref LogTester::Test "tester application" is provided.<br/>
  * To run the <a href="https://github.com/philsquared/Catch">Catch</a> unit tests go to the CatchUnitTests project under tests/UnitTests.<br/>
- * <b>Tip:</b> From VS run the unit test by hitting Ctrl + F5 to prevent the console to disappear at the end.
+ * <b>Tip:</b> From VS run the unit test by hitting Ctrl + F5 to prevent the console to disappear at the end.<br/>
+ * To measure the performance run the LogBenchmark project under tests/Benchmarks. It writes
+ * the producer cost, throughput, latency percentiles and allocations per call of every
+ * scenario into benchmark.json, so the results of different releases can be compared.
  * 
  */
 class Logger
@@ -213,9 +1284,14 @@ class Logger
     std::unique_ptr<Impl> _pImpl;
 public:
     /// Create a logger with the specified global threshold and
-    /// category.
+    /// category. It gets its own LoggingEngine.
     explicit Logger(const Priority globalThreshold_ = Priority::Info
         , const std::string& category_ = "global");
+    /// Create a logger with the specified global threshold and
+    /// category which is attached to the given engine.
+    explicit Logger(const LoggingEngine::ptr_t& engine_
+        , const Priority globalThreshold_ = Priority::Info
+        , const std::string& category_ = "global");
     ~Logger();
 
     /// Log a message with the given parameters.
@@ -228,6 +1304,31 @@ public:
         , const char* file_
         , int line_
         , const std::thread::id threadId_);
+    /// Log the size_ bytes of message_, which are copied before returning.
+    void operator()(const char* message_
+        , const size_t size_
+        , const Priority pri_
+        , const char* function_
+        , const char* file_
+        , int line_
+        , const std::thread::id threadId_);
+    /// Log the size_ bytes of message_ and its structured fields encoded by
+    /// a LogStream, both are copied before returning.
+    void operator()(const char* message_
+        , const size_t size_
+        , const LogLine& fields_
+        , const Priority pri_
+        , const char* function_
+        , const char* file_
+        , int line_
+        , const std::thread::id threadId_);
+    /// Log a message whose text is rendered later by the backend thread.
+    void operator()(std::unique_ptr<DeferredText>&& text_
+        , const Priority pri_
+        , const char* function_
+        , const char* file_
+        , int line_
+        , const std::thread::id threadId_);
     
     /// Set the logger's category so it will be distinguishable.
     void category(const std::string& category_);
@@ -237,6 +1338,18 @@ public:
     /// <b>Important Note:</b> The log destinations cannot log
     /// messages with lower priority than the global threshold.
     void addDest(const std::string& name_, const Priority thresHold_, LogDest::ptr_t&& dest_);
+    /// Add a log target which may be shared with other Loggers.
+    template <class Dest>
+    void addDest(const std::string& name_, const std::shared_ptr<Dest>& dest_)
+    {
+        addSharedDest(name_, threshold(), dest_);
+    }
+    /// Add a log target which may be shared with other Loggers and specify its threshold.
+    template <class Dest>
+    void addDest(const std::string& name_, const Priority thresHold_, const std::shared_ptr<Dest>& dest_)
+    {
+        addSharedDest(name_, thresHold_, dest_);
+    }
     /// Enabled/disable log destination.
     void permitDest(const std::string& name_, const bool enable_);
     /// Set the global log priority threshold. Messages with lower priority than
@@ -247,6 +1360,19 @@ public:
     /// <b>Important Note:</b> Even if we set it the log destinations cannot log
     /// messages with lower priority than the global threshold.
     void threshold(const std::string& destName_, const Priority threshold_);
+    /// Collapse the consecutive duplicates (same call site and message) written
+    /// to a log target within the window into one line and a
+    /// "last message repeated N times" summary. A zero window disables it.
+    void dedup(const std::string& destName_, const std::chrono::milliseconds window_);
+    /// Block until every message logged before this call is written
+    /// and all the destinations are flushed.<br/>
+    /// Concurrent loggers are not stopped, messages logged after
+    /// this call was made may or may not be written by then.
+    /// If the LoggingEngine is shared this is the same as LoggingEngine::flush().
+    void flush();
+    /// Same as flush() but gives up after the specified time.
+    /// @return true if everything was written and flushed in time
+    bool flush(const std::chrono::milliseconds timeout_);
     /// Set a callback function which is called when the logger
     /// destructs itself. It is ensured that all the destinations
     /// are flushed before this call.
@@ -256,8 +1382,11 @@ public:
     /// Its default value is <i>Error</i>.
     void errorThreshold(const Priority errorThreshold_);
 
-    /// @return the current category of the logger
-    const std::string& category() const;
+    /// @return the current category of the logger, a copy as another
+    ///         thread may set a new one any time
+    std::string category() const;
+    /// @return the global log priority threshold
+    Priority threshold() const;
     /// Get the currently set minimum log priority which we consider an error.
     /// @return the error threshold priority
     Priority errorThreshold() const;
@@ -266,27 +1395,172 @@ public:
     bool logging(const Priority pri_) const;
     /// @return true if the specified destination is enabled
     bool logging(const std::string& destName_) const;
+    /// Collect the statistics of the Logger. The counters are updated with
+    /// relaxed atomics so the snapshot is not necessarily consistent.
+    LogStats stats() const;
+    /// Cheap check used by the MRLog* macros before formatting anything.
+    /// @return true if a message with the specified priority passes the global
+    ///         threshold and at least one enabled destination would write it
+    bool accepts(const Priority pri_) const;
+    /// Same as accepts() but also applies the rate limit of the call site,
+    /// at the given location of the source.
+    bool accepts(const Priority pri_
+        , LogSite& site_
+        , const char* function_
+        , const char* file_
+        , int line_) const;
+    /// Limit every call site logging with the specified priority which has
+    /// no limit of its own. Pass RateLimit{} to remove the limit.
+    void rateLimit(const Priority pri_, const RateLimit& limit_);
 
     Logger(const Logger&) = delete;
     Logger& operator=(const Logger&) = delete;
     Logger(Logger&&) = delete;
     Logger& operator=(Logger&&) = delete;
+
+private:
+    void addSharedDest(const std::string& name_, const Priority thresHold_, const LogDest::shared_ptr_t& dest_);
 };
 
+//=============================================================================
+// Source locations of the messages
+
+// How the macros log the source file of the messages: the full __FILE__, its
+// base name, or its path relative to MULTILOGGER_SOURCE_ROOT, e.g.
+// -DMULTILOGGER_FILE_STYLE=MULTILOGGER_FILE_RELATIVE -DMULTILOGGER_SOURCE_ROOT=\"/home/build/src/\"
+#define MULTILOGGER_FILE_FULL       0
+#define MULTILOGGER_FILE_BASENAME   1
+#define MULTILOGGER_FILE_RELATIVE   2
+#ifndef MULTILOGGER_FILE_STYLE
+# define MULTILOGGER_FILE_STYLE MULTILOGGER_FILE_BASENAME
+#endif
+#if (MULTILOGGER_FILE_STYLE == MULTILOGGER_FILE_RELATIVE) && !defined(MULTILOGGER_SOURCE_ROOT)
+# error "MULTILOGGER_FILE_RELATIVE requires MULTILOGGER_SOURCE_ROOT"
+#endif
+
+// How the macros log the function of the messages, if __FUNCTION__ has
+// scopes as with MSVC: unchanged, with its innermost scope only, so member
+// functions keep their class, e.g. Class::method, or without any scope.
+#define MULTILOGGER_FUNCTION_FULL   0
+#define MULTILOGGER_FUNCTION_SCOPED 1
+#define MULTILOGGER_FUNCTION_NAME   2
+#ifndef MULTILOGGER_FUNCTION_STYLE
+# if (MULTILOGGER_FILE_STYLE == MULTILOGGER_FILE_FULL)
+#  define MULTILOGGER_FUNCTION_STYLE MULTILOGGER_FUNCTION_FULL
+# else
+#  define MULTILOGGER_FUNCTION_STYLE MULTILOGGER_FUNCTION_SCOPED
+# endif
+#endif
+
+#ifdef USING_CPP14
+namespace imp
+{
+
+/// @return the part of path_ after its last slash or backslash
+constexpr const char* baseName(const char* path_)
+{
+    auto name = path_;
+    for (auto i = size_t{0}; path_[i] != '\0'; ++i) {
+        if (path_[i] == '/' || path_[i] == '\\') {
+            name = path_ + i + 1;
+        }
+    }
+    return name;
+}
+
+/// @return path_ without root_ and the separators following it,
+///         or path_ if it is not under root_
+constexpr const char* relativePath(const char* path_, const char* root_)
+{
+    auto i = size_t{0};
+    for (; root_[i] != '\0'; ++i) {
+        if (path_[i] != root_[i]) {
+            return path_;
+        }
+    }
+    while (path_[i] == '/' || path_[i] == '\\') {
+        ++i;
+    }
+    return path_ + i;
+}
+
+/// @return path_ as MULTILOGGER_FILE_STYLE selects
+constexpr const char* sourceFile(const char* path_)
+{
+#if (MULTILOGGER_FILE_STYLE == MULTILOGGER_FILE_BASENAME)
+    return baseName(path_);
+#elif (MULTILOGGER_FILE_STYLE == MULTILOGGER_FILE_RELATIVE)
+    return relativePath(path_, MULTILOGGER_SOURCE_ROOT);
+#else
+    return path_;
+#endif
+}
+
+/// @return function_ with the scopes MSVC puts into __FUNCTION__ kept as
+///         style_ (see MULTILOGGER_FUNCTION_STYLE) selects
+constexpr const char* functionName(const char* function_, const int style_ = MULTILOGGER_FUNCTION_STYLE)
+{
+    if (style_ == MULTILOGGER_FUNCTION_FULL) {
+        return function_;
+    }
+    auto name = function_;
+    auto scope = function_;
+    auto depth = 0;
+    for (auto i = size_t{0}; function_[i] != '\0'; ++i) {
+        const auto c = function_[i];
+        depth += (c == '<' || c == '(') ? 1 : (c == '>' || c == ')') ? -1 : 0;
+        if (depth == 0 && c == ':' && function_[i + 1] == ':') {
+            scope = name;
+            name = function_ + i + 2;
+        }
+    }
+    return (style_ == MULTILOGGER_FUNCTION_NAME) ? name : scope;
+}
+
+}
+
+/// Defines mrFile_ and mrFunction_, trimmed at compile time.
+#define MRLogSource_                                            \
+    static constexpr const char* mrFile_ =                      \
+        ::MultiLogger::imp::sourceFile(__FILE__);               \
+    static constexpr const char* mrFunction_ =                  \
+        ::MultiLogger::imp::functionName(__FUNCTION__)
+#else
+#define MRLogSource_                                            \
+    const char* const mrFile_ = __FILE__;                       \
+    const char* const mrFunction_ = __FUNCTION__
+#endif
+
 //=============================================================================
 // Local loggers' macro helpers
 
-#define MRLogL(__LoggeR__, __PrioritY__, __MessagE__)           \
-    __LoggeR__(                                                 \
-        static_cast<std::ostringstream&>(                       \
-          std::ostringstream().flush() << __MessagE__           \
-        ).str()                                                 \
-        ,__PrioritY__                                           \
-        ,__FUNCTION__                                           \
-        ,__FILE__                                               \
-        ,__LINE__                                               \
-        ,std::this_thread::get_id()                             \
-    )
+#define MRLogSiteL(__LoggeR__, __PrioritY__, __SitE__, __MessagE__) \
+    do {                                                        \
+        static ::MultiLogger::LogSite mrSite_ __SitE__;         \
+        MRLogSource_;                                           \
+        auto& mrLogger_ = (__LoggeR__);                         \
+        const ::MultiLogger::Priority mrPri_ = __PrioritY__;    \
+        if (mrLogger_.accepts(mrPri_, mrSite_                   \
+            , mrFunction_, mrFile_, __LINE__)) {                \
+            ::MultiLogger::LogStream<> mrStream_;               \
+            mrStream_ << __MessagE__ << mrSite_.suppressed();   \
+            mrLogger_(                                          \
+                mrStream_.data()                                \
+                ,mrStream_.size()                               \
+                ,mrStream_.fields()                             \
+                ,mrPri_                                         \
+                ,mrFunction_                                    \
+                ,mrFile_                                        \
+                ,__LINE__                                       \
+                ,std::this_thread::get_id()                     \
+            );                                                  \
+        }                                                       \
+    } while (false)
+
+#define MRLogL(__LoggeR__, __PrioritY__, __MessagE__)           MRLogSiteL(__LoggeR__, __PrioritY__, {}, __MessagE__)
+/// Log with a RateLimit of this call site, e.g.
+/// MRLogLimitL(log, Priority::Warning, ::MultiLogger::RateLimit::perSecond(10), "overheating");
+#define MRLogLimitL(__LoggeR__, __PrioritY__, __LimiT__, __MessagE__) MRLogSiteL(__LoggeR__, __PrioritY__, {__LimiT__}, __MessagE__)
 
 #define MRLogDebugL(__LoggeR__, __MessagE__)        MRLogL(__LoggeR__, ::MultiLogger::Priority::Debug, __MessagE__)
 #define MRLogInfoL(__LoggeR__, __MessagE__)         MRLogL(__LoggeR__, ::MultiLogger::Priority::Info, __MessagE__)
@@ -294,6 +1568,150 @@ public:
 #define MRLogErrorL(__LoggeR__, __MessagE__)        MRLogL(__LoggeR__, ::MultiLogger::Priority::Error, __MessagE__)
 #define MRLogCriticalL(__LoggeR__, __MessagE__)     MRLogL(__LoggeR__, ::MultiLogger::Priority::Critical, __MessagE__)
 
+/// C++20 deprecates capturing this implicitly with [=], which the
+/// deferred messages of member functions do. They name no this to
+/// capture it explicitly, as they may be used outside of classes too.
+#if defined(__GNUC__) && (__cplusplus > 201703L)
+#define MRLogCaptureBegin_                                      \
+    _Pragma("GCC diagnostic push")                              \
+    _Pragma("GCC diagnostic ignored \"-Wdeprecated\"")
+#define MRLogCaptureEnd_                                        \
+    _Pragma("GCC diagnostic pop")
+#else
+#define MRLogCaptureBegin_
+#define MRLogCaptureEnd_
+#endif
+
+/**
+ * Log a message formatted by the backend thread, e.g.
+ * MRLogDeferredL(log, Priority::Debug, "tree " << MultiLogger::lazy([tree]() { return tree->dump(); }));
+ * The message captures everything it uses by value, pointers and references
+ * must stay valid until the message is written (see Logger::flush()).
+ * In a member function this is captured as a pointer, so the object must
+ * stay valid too.
+ */
+#define MRLogDeferredL(__LoggeR__, __PrioritY__, __MessagE__)   \
+    do {                                                        \
+        static ::MultiLogger::LogSite mrSite_;                  \
+        MRLogSource_;                                           \
+        auto& mrLogger_ = (__LoggeR__);                         \
+        const ::MultiLogger::Priority mrPri_ = __PrioritY__;    \
+        if (mrLogger_.accepts(mrPri_, mrSite_                   \
+            , mrFunction_, mrFile_, __LINE__)) {                \
+            const auto mrSuppressed_ = mrSite_.suppressed();    \
+            MRLogCaptureBegin_                                  \
+            auto mrText_ = ::MultiLogger::deferred(             \
+                [=](std::ostream& mrOut_) {                     \
+                    mrOut_ << __MessagE__ << mrSuppressed_;     \
+                });                                             \
+            MRLogCaptureEnd_                                    \
+            mrLogger_(                                          \
+                std::move(mrText_)                              \
+                ,mrPri_                                         \
+                ,mrFunction_                                    \
+                ,mrFile_                                        \
+                ,__LINE__                                       \
+                ,std::this_thread::get_id()                     \
+            );                                                  \
+        }                                                       \
+    } while (false)
+
+#ifdef USING_CPP14
+#define MRLogExpand_(__X__) __X__
+#define MRLogFirst_(__FirsT__, ...) __FirsT__
+#define MRLogFormatOf_(...) MRLogExpand_(MRLogFirst_(__VA_ARGS__, ~))
+
+/// Log with a format string checked and compiled at compile time, e.g.
+/// MRLogf(log, Priority::Info, "user {} age {}", name, age);
+/// Every {} is replaced by the next argument, {{ and }} stand for { and }.
+#define MRLogf(__LoggeR__, __PrioritY__, ...)                   \
+    do {                                                        \
+        static_assert(::MultiLogger::imp::formatShape(          \
+            MRLogFormatOf_(__VA_ARGS__))._valid                 \
+            , "unmatched { or } in the format string");         \
+        static_assert(::MultiLogger::imp::formatShape(          \
+            MRLogFormatOf_(__VA_ARGS__))._slots                 \
+            == decltype(::MultiLogger::imp::formatArguments(    \
+                __VA_ARGS__))::value                            \
+            , "the number of {} and arguments differ");         \
+        static constexpr auto mrFormat_ = ::MultiLogger::imp::  \
+            compileFormat<::MultiLogger::imp::formatShape(      \
+                MRLogFormatOf_(__VA_ARGS__))._pieces>(          \
+                    MRLogFormatOf_(__VA_ARGS__));               \
+        static ::MultiLogger::LogSite mrSite_;                  \
+        MRLogSource_;                                           \
+        auto& mrLogger_ = (__LoggeR__);                         \
+        const ::MultiLogger::Priority mrPri_ = __PrioritY__;    \
+        if (mrLogger_.accepts(mrPri_, mrSite_                   \
+            , mrFunction_, mrFile_, __LINE__)) {                \
+            ::MultiLogger::LogStream<> mrStream_;               \
+            ::MultiLogger::imp::renderFormat(mrStream_          \
+                , mrFormat_, __VA_ARGS__);                      \
+            mrStream_ << mrSite_.suppressed();                  \
+            mrLogger_(                                          \
+                mrStream_.data()                                \
+                ,mrStream_.size()                               \
+                ,mrStream_.fields()                             \
+                ,mrPri_                                         \
+                ,mrFunction_                                    \
+                ,mrFile_                                        \
+                ,__LINE__                                       \
+                ,std::this_thread::get_id()                     \
+            );                                                  \
+        }                                                       \
+    } while (false)
+#endif
+
+//=============================================================================
+// Threads
+
+/// The log lines show the threads by small indices in the order they first
+/// logged. Call this to show name_ instead for the calling thread.
+void setThreadName(const std::string& name_);
+
+//=============================================================================
+// Mapped diagnostic context
+
+namespace imp
+{
+struct Context;
+}
+
+/**
+ * Adds structured fields to the context of the calling thread while it
+ * lives, e.g.
+ * MultiLogger::ScopedContext request{MultiLogger::kv("request", id), MultiLogger::kv("tenant", tenant)};
+ * Every message the thread logs meanwhile carries the fields of its
+ * context, the ones of the enclosing guards first, before its own fields.
+ * The contexts are interned snapshots: a message only refers to the current
+ * one and the backend renders a snapshot once, when the context of the
+ * thread changes.
+ * The guards of a thread have to be destroyed in the reverse order of
+ * their construction, as scoped variables are.
+ */
+class ScopedContext
+{
+public:
+    template <class... T>
+    explicit ScopedContext(const imp::KeyValue<T>&... fields_)
+    {
+        imp::Fields fields;
+        const int expand[] = {0, (imp::addField(fields, fields_._key, fields_._value), 0)...};
+        static_cast<void>(expand);
+        push(fields.data(), fields.size());
+    }
+    ~ScopedContext();
+
+    ScopedContext(const ScopedContext&) = delete;
+    ScopedContext& operator=(const ScopedContext&) = delete;
+
+private:
+    void push(const char* fields_, const size_t size_);
+
+    const imp::Context*     _context;
+    const imp::Context*     _previous;
+};
+
 //=============================================================================
 // The global logger and its macro helpers
 
@@ -302,10 +1720,15 @@ public:
 Logger& globalLogger();
 
 #define MRLogG(__PrioritY__, __MessagE__)           MRLogL(::MultiLogger::globalLogger(), __PrioritY__, __MessagE__)
+#define MRLogLimitG(__PrioritY__, __LimiT__, __MessagE__) MRLogLimitL(::MultiLogger::globalLogger(), __PrioritY__, __LimiT__, __MessagE__)
 #define MRLogDebugG(__MessagE__)                    MRLogDebugL(::MultiLogger::globalLogger(), __MessagE__)
 #define MRLogInfoG(__MessagE__)                     MRLogInfoL(::MultiLogger::globalLogger(), __MessagE__)
 #define MRLogWarningG(__MessagE__)                  MRLogWarningL(::MultiLogger::globalLogger(), __MessagE__)
 #define MRLogErrorG(__MessagE__)                    MRLogErrorL(::MultiLogger::globalLogger(), __MessagE__)
 #define MRLogCriticalG(__MessagE__)                 MRLogCriticalL(::MultiLogger::globalLogger(), __MessagE__)
+#define MRLogDeferredG(__PrioritY__, __MessagE__)   MRLogDeferredL(::MultiLogger::globalLogger(), __PrioritY__, __MessagE__)
+#ifdef USING_CPP14
+#define MRLogfG(__PrioritY__, ...)                  MRLogf(::MultiLogger::globalLogger(), __PrioritY__, __VA_ARGS__)
+#endif
 
 } // namespace MultiLogger
@@ -0,0 +1,69 @@
+#include "Allocations.h"
+
+#include <cstdlib>
+#include <new>
+
+/**
+ * @file
+ * The replaced allocation functions of the benchmark, which call the hook
+ * installed with LogBenchmark::allocationHook().
+ * They are kept out of benchmark.cpp, so no translation unit sees both the
+ * new expressions and the std::free of the replaced operator delete: GCC
+ * would report them as a mismatched pair (-Wmismatched-new-delete).
+ * The array, nothrow and sized forms of the standard library call these,
+ * so every pair matches. The over-aligned forms keep their own matching
+ * pair and are not counted, the library does not use them.
+ */
+
+#if defined(LOG_BENCHMARK_TRACK_MALLOC) && defined(__GLIBC__)
+
+extern "C"
+{
+
+void* __libc_malloc(size_t size_);
+void* __libc_calloc(size_t count_, size_t size_);
+void* __libc_realloc(void* ptr_, size_t size_);
+
+void* malloc(size_t size_)
+{
+    LogBenchmark::onAllocate(size_);
+    return __libc_malloc(size_);
+}
+
+void* calloc(size_t count_, size_t size_)
+{
+    LogBenchmark::onAllocate(count_ * size_);
+    return __libc_calloc(count_, size_);
+}
+
+void* realloc(void* ptr_, size_t size_)
+{
+    LogBenchmark::onAllocate(size_);
+    return __libc_realloc(ptr_, size_);
+}
+
+}
+
+#endif
+
+/// Count the allocations through the hook.
+void* operator new(std::size_t size_)
+{
+#if !(defined(LOG_BENCHMARK_TRACK_MALLOC) && defined(__GLIBC__))
+    LogBenchmark::onAllocate(size_);
+#endif
+    if (auto ptr = std::malloc(size_ == 0 ? 1 : size_)) {
+        return ptr;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr_) noexcept
+{
+    std::free(ptr_);
+}
+
+void operator delete(void* ptr_, std::size_t) noexcept
+{
+    std::free(ptr_);
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @file
+ * The allocation tracking hooks of the benchmark.
+ *
+ * The benchmark replaces the global operator new in Allocations.cpp, which
+ * calls the installed hook with the size of every allocation. If the benchmark is built with
+ * LOG_BENCHMARK_TRACK_MALLOC on glibc, malloc, calloc and realloc call it
+ * instead, so the allocations bypassing operator new are counted as well.
+ *
+ * The default hook, countThread(), counts the allocations of the calling
+ * thread only, which costs next to nothing. countProcess() counts every
+ * allocation in shared atomics too, including the ones of the backend
+ * threads, at the price of some contention between the threads.
+ */
+
+namespace LogBenchmark
+{
+
+/// Number and total size of allocations.
+struct Allocations
+{
+    Allocations operator-(const Allocations& rhs_) const
+    {
+        return Allocations{_count - rhs_._count, _bytes - rhs_._bytes};
+    }
+
+    std::uint64_t   _count;
+    std::uint64_t   _bytes;
+};
+
+using allocation_hook_t = void (*)(const std::size_t bytes_);
+
+namespace imp
+{
+
+inline Allocations& threadAllocations()
+{
+    thread_local Allocations allocations{0, 0};
+    return allocations;
+}
+
+inline std::atomic<std::uint64_t>& processCount()
+{
+    static std::atomic<std::uint64_t> count{0};
+    return count;
+}
+
+inline std::atomic<std::uint64_t>& processBytes()
+{
+    static std::atomic<std::uint64_t> bytes{0};
+    return bytes;
+}
+
+} // namespace imp
+
+/// Hook counting the allocation for the calling thread.
+inline void countThread(const std::size_t bytes_)
+{
+    auto& allocations = imp::threadAllocations();
+    ++allocations._count;
+    allocations._bytes += bytes_;
+}
+
+/// Hook counting the allocation for the calling thread and the process.
+inline void countProcess(const std::size_t bytes_)
+{
+    countThread(bytes_);
+    imp::processCount().fetch_add(1, std::memory_order_relaxed);
+    imp::processBytes().fetch_add(bytes_, std::memory_order_relaxed);
+}
+
+namespace imp
+{
+
+inline std::atomic<allocation_hook_t>& hook()
+{
+    static std::atomic<allocation_hook_t> hook{&countThread};
+    return hook;
+}
+
+} // namespace imp
+
+/// Install the hook called on every allocation.
+inline void allocationHook(const allocation_hook_t hook_)
+{
+    imp::hook().store(hook_);
+}
+
+/// Called by the replaced allocation functions.
+inline void onAllocate(const std::size_t bytes_)
+{
+    imp::hook().load(std::memory_order_relaxed)(bytes_);
+}
+
+/// @return the allocations of the calling thread so far
+inline Allocations threadAllocations()
+{
+    return imp::threadAllocations();
+}
+
+/// @return the allocations of every thread counted by countProcess()
+inline Allocations processAllocations()
+{
+    return Allocations{imp::processCount().load(std::memory_order_relaxed)
+        , imp::processBytes().load(std::memory_order_relaxed)};
+}
+
+} // namespace LogBenchmark
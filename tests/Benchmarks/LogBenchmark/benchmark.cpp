@@ -0,0 +1,747 @@
+#include "../../../lib/MultiLogger/Log.cpp"
+#include "Allocations.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <iomanip>
+
+#ifdef _WIN32
+# include <windows.h>
+# include <psapi.h>
+# pragma comment(lib, "psapi.lib")
+#else
+# include <unistd.h>
+#endif
+
+/**
+ * @file
+ * Throughput and latency benchmarks of the @ref MultiLogger::Logger "Logger".
+ *
+ * Usage: LogBenchmark [--quick] [--allocations] [--threads N] [--soak SECONDS] [--out results.json]
+ *
+ * Every scenario logs the same short message with a few formatted numbers.
+ * The stage scenarios measure the steps of the pipeline one by one:
+ *   * format: the LogStream the MRLog* macros build the message with
+ *   * format_inline_N_short/long: a LogStream with an inline capacity of N
+ *     bytes formatting a short or a ~200 byte message, the long one spills
+ *     to the heap if it does not fit (see MULTILOGGER_INLINE_CAPACITY)
+ *   * format_ostringstream: the std::ostringstream used before LogStream
+ *   * format_compiled: the same message with the compiled format of MRLogf
+ *   * format_fields: the same values as structured fields (see kv())
+ *   * format_numeric: a message of random integers and doubles, as the Test
+ *     application logs them, with the std::to_chars based LogStream, with a
+ *     LogStream using the standard locale facets (format_numeric_facets)
+ *     and with std::ostringstream (format_numeric_ostringstream)
+ *   * enqueue: handing over an already formatted message to the engine
+ *   * ordering: pushing and popping the records in the priority queue
+ *   * render: formatting the complete line in the backend, with the source
+ *     file as the macros log it, and with the full path (render_full_path)
+ *   * render_pattern: the same line with a Layout other than the classic one
+ *   * render_fields: a message with two structured fields in the classic
+ *     layout and as JSON (render_json)
+ *   * render_context: the same message with two fields of a ScopedContext
+ *     instead, rendered once for the batch
+ *   * dispatch: a batch write of the rendered lines to a destination
+ *   .
+ * The results are written as JSON to the output file (benchmark.json by
+ * default) so the numbers of different releases can be compared, and a
+ * short summary goes to the standard error.
+ * Every scenario reports the number and the size of the allocations per
+ * message made by the logging threads. With --allocations every allocation
+ * of the process is counted (see Allocations.h), and the throughput
+ * scenarios report the allocations of the backend as well.
+ * The soak scenario (only with --soak) logs messages of mixed sizes at a
+ * steady rate for the given time, e.g. 86400 for a day, and samples the
+ * resident memory every second to reveal leaks and fragmentation.
+ * The stdout scenarios write a lot of lines to the standard output,
+ * redirect it to /dev/null (NUL on Windows) to measure the library only.
+ */
+
+namespace LogBenchmark
+{
+
+namespace
+{
+
+using steady_clock_t = std::chrono::steady_clock;
+
+std::uint64_t nanosSince(const steady_clock_t::time_point start_)
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(steady_clock_t::now() - start_).count());
+}
+
+//=============================================================================
+
+struct Options
+{
+    bool            _quick{false};
+    bool            _allocations{false};
+    size_t          _maxThreads{std::max(1u, std::thread::hardware_concurrency())};
+    size_t          _soakSeconds{0};
+    std::string     _out{"benchmark.json"};
+};
+
+/// The measured values of a scenario in the order they were added.
+struct Result
+{
+    void add(const std::string& key_, const double value_)
+    {
+        _values.emplace_back(key_, value_);
+    }
+
+    void addLatency(const std::string& prefix_, const MultiLogger::LatencyHistogram& histogram_)
+    {
+        add(prefix_ + "_p50_ns", static_cast<double>(histogram_.percentile(0.5)));
+        add(prefix_ + "_p99_ns", static_cast<double>(histogram_.percentile(0.99)));
+        add(prefix_ + "_p999_ns", static_cast<double>(histogram_.percentile(0.999)));
+        add(prefix_ + "_max_ns", static_cast<double>(histogram_._max));
+    }
+
+    void addAllocations(const std::string& prefix_, const Allocations& allocations_, const double ops_)
+    {
+        add(prefix_ + "allocs_per_op", static_cast<double>(allocations_._count) / ops_);
+        add(prefix_ + "bytes_per_op", static_cast<double>(allocations_._bytes) / ops_);
+    }
+
+    std::string                                     _name;
+    std::vector<std::pair<std::string, double>>     _values;
+};
+
+using results_t = std::vector<Result>;
+
+template <class Ostream>
+Ostream& operator<<(Ostream& lhs_, const Result& rhs_)
+{
+    lhs_ << "{\"name\": \"" << rhs_._name << '"';
+    for (const auto& value : rhs_._values) {
+        lhs_ << ", \"" << value.first << "\": " << value.second;
+    }
+    return lhs_ << '}';
+}
+
+//=============================================================================
+
+/// Run body_(threadIndex) on threads_ threads started at the same time.
+template <class Body>
+void runThreads(const size_t threads_, Body&& body_)
+{
+    std::atomic_bool go{false};
+    std::vector<std::thread> threads;
+    threads.reserve(threads_);
+    for (auto t = size_t{0}; t < threads_; ++t) {
+        threads.emplace_back([&go, &body_, t]() {
+            while (!go.load()) {
+                std::this_thread::yield();
+            }
+            body_(t);
+        });
+    }
+    go = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+/// The thread counts measured: 1, 2, 4, ... up to max_.
+std::vector<size_t> threadCounts(const size_t max_)
+{
+    std::vector<size_t> counts;
+    for (auto threads = size_t{1}; threads < max_; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(max_);
+    return counts;
+}
+
+//=============================================================================
+
+/**
+ * Log opsPerThread_ messages from every thread into the destination, then
+ * flush. Measures the producer side cost per call, the allocations per call,
+ * the sustained throughput until everything is written and the
+ * enqueue-to-write latency reported by Logger::stats(). If every allocation
+ * of the process is tracked the allocations of the backend are reported too.
+ */
+Result throughput(const std::string& destName_
+    , MultiLogger::LogDest::ptr_t&& dest_
+    , const size_t threads_
+    , const size_t opsPerThread_
+    , const bool trackProcess_)
+{
+    MultiLogger::Logger log{MultiLogger::Priority::Info, "bench"};
+    log.addDest(destName_, std::move(dest_));
+
+    std::atomic<std::uint64_t> producerNanos{0};
+    std::atomic<std::uint64_t> producerAllocs{0};
+    std::atomic<std::uint64_t> producerBytes{0};
+    const auto processBefore = processAllocations();
+    const auto mainBefore = threadAllocations();
+    const auto start = steady_clock_t::now();
+    runThreads(threads_, [&](const size_t thread_) {
+        const auto allocsBefore = threadAllocations();
+        const auto threadStart = steady_clock_t::now();
+        for (auto i = size_t{0}; i < opsPerThread_; ++i) {
+            MRLogInfoL(log, "benchmark message " << i << " from thread " << thread_ << " value " << 3.14159);
+        }
+        producerNanos += nanosSince(threadStart);
+        const auto allocs = threadAllocations() - allocsBefore;
+        producerAllocs += allocs._count;
+        producerBytes += allocs._bytes;
+    });
+    log.flush();
+    const auto seconds = static_cast<double>(nanosSince(start)) / 1e9;
+    const auto producer = Allocations{producerAllocs.load(), producerBytes.load()};
+    // everything else, apart from starting the threads, is done by the backend
+    const auto backend = processAllocations() - processBefore - producer - (threadAllocations() - mainBefore);
+
+    const auto ops = static_cast<double>(threads_ * opsPerThread_);
+    const auto stats = log.stats();
+    Result result;
+    result._name = "throughput/" + destName_;
+    result.add("threads", static_cast<double>(threads_));
+    result.add("ops", ops);
+    result.add("producer_ns_per_op", static_cast<double>(producerNanos.load()) / ops);
+    result.addAllocations("", producer, ops);
+    if (trackProcess_) {
+        result.addAllocations("backend_", backend, ops);
+    }
+    result.add("msgs_per_s", ops / seconds);
+    result.add("mb_per_s", static_cast<double>(stats._dests.front()._bytes) / seconds / 1e6);
+    result.add("peak_queue_depth", static_cast<double>(stats._peakQueueDepth));
+    result.addLatency("write_latency", stats._latency);
+    return result;
+}
+
+/// Time every call separately to get the distribution of the producer latency.
+Result callLatency(const size_t threads_, const size_t opsPerThread_)
+{
+    MultiLogger::Logger log{MultiLogger::Priority::Info, "bench"};
+    log.addDest("null", MultiLogger::cpp14::imp::make_unique<MultiLogger::NullDest>());
+
+    std::vector<MultiLogger::LatencyHistogram> histograms(threads_);
+    runThreads(threads_, [&](const size_t thread_) {
+        auto& histogram = histograms[thread_];
+        histogram._counts.fill(0);
+        histogram._count = 0;
+        histogram._max = 0;
+        for (auto i = size_t{0}; i < opsPerThread_; ++i) {
+            const auto callStart = steady_clock_t::now();
+            MRLogInfoL(log, "benchmark message " << i << " from thread " << thread_ << " value " << 3.14159);
+            const auto nanos = nanosSince(callStart);
+            ++histogram._counts[MultiLogger::LatencyHistogram::bucketOf(nanos)];
+            ++histogram._count;
+            histogram._max = std::max(histogram._max, nanos);
+        }
+    });
+    log.flush();
+
+    auto total = histograms.front();
+    for (auto t = size_t{1}; t < threads_; ++t) {
+        for (auto i = size_t{0}; i < MultiLogger::LatencyHistogram::buckets; ++i) {
+            total._counts[i] += histograms[t]._counts[i];
+        }
+        total._count += histograms[t]._count;
+        total._max = std::max(total._max, histograms[t]._max);
+    }
+
+    Result result;
+    result._name = "call_latency/null";
+    result.add("threads", static_cast<double>(threads_));
+    result.add("ops", static_cast<double>(total._count));
+    result.addLatency("call_latency", total);
+    return result;
+}
+
+/// Cost of a statement which is not logged, either because of the
+/// threshold of the Logger or because no destination accepts it.
+Result disabled(const std::string& name_, const bool belowThreshold_, const size_t ops_)
+{
+    MultiLogger::Logger log{MultiLogger::Priority::Info, "bench"};
+    log.addDest("null", MultiLogger::Priority::Error, MultiLogger::cpp14::imp::make_unique<MultiLogger::NullDest>());
+
+    const auto allocsBefore = threadAllocations();
+    const auto start = steady_clock_t::now();
+    for (auto i = size_t{0}; i < ops_; ++i) {
+        if (belowThreshold_) {
+            MRLogDebugL(log, "disabled message " << i << " value " << 3.14159);
+        } else {
+            MRLogInfoL(log, "disabled message " << i << " value " << 3.14159);
+        }
+    }
+    const auto nanos = nanosSince(start);
+
+    Result result;
+    result._name = "disabled/" + name_;
+    result.add("ops", static_cast<double>(ops_));
+    result.add("ns_per_op", static_cast<double>(nanos) / static_cast<double>(ops_));
+    result.addAllocations("", threadAllocations() - allocsBefore, static_cast<double>(ops_));
+    return result;
+}
+
+//=============================================================================
+
+/// Time ops_ calls of step_(i), each processing items_ messages, and
+/// report the cost per message.
+template <class Step>
+Result stage(const std::string& name_, const size_t ops_, const size_t items_, Step&& step_)
+{
+    const auto allocsBefore = threadAllocations();
+    const auto start = steady_clock_t::now();
+    for (auto i = size_t{0}; i < ops_; ++i) {
+        step_(i);
+    }
+    const auto nanos = nanosSince(start);
+
+    const auto messages = static_cast<double>(ops_ * items_);
+    Result result;
+    result._name = "stage/" + name_;
+    result.add("ops", messages);
+    result.add("ns_per_op", static_cast<double>(nanos) / messages);
+    result.addAllocations("", threadAllocations() - allocsBefore, messages);
+    return result;
+}
+
+/// The records of a batch as the backend receives them, their texts are in texts_.
+std::vector<MultiLogger::LogRecord> records(const MultiLogger::LogSource* source_
+    , const size_t count_
+    , const std::string& message_
+    , std::deque<std::string>& texts_
+    , const char* file_ = __FILE__)
+{
+    std::vector<MultiLogger::LogRecord> records;
+    records.reserve(count_);
+    const auto now = std::chrono::system_clock::now();
+    const auto thread = MultiLogger::threadOf(std::this_thread::get_id());
+    for (auto i = size_t{0}; i < count_; ++i) {
+        // producers on different threads enqueue slightly out of order
+        const auto time = now + std::chrono::nanoseconds{static_cast<std::int64_t>((i * 7919) % 1024)};
+        texts_.push_back(message_ + std::to_string(i));
+        records.push_back(MultiLogger::LogRecord{time, i, 0, source_, MultiLogger::Priority::Info
+            , __FUNCTION__, file_, __LINE__, thread
+            , texts_.back().data(), texts_.back().size(), 0, nullptr, nullptr, nullptr});
+    }
+    return records;
+}
+
+/// Report formatting a short and a long message with a LogStream of Capacity bytes.
+template <size_t Capacity>
+void formatInline(const size_t ops_, const std::function<void(Result&&)>& report_)
+{
+    const std::string padding(160, 'x');
+    size_t sink = 0;
+    const auto name = "format_inline_" + std::to_string(Capacity);
+    report_(stage(name + "_short", ops_, 1, [&sink](const size_t i_) {
+        MultiLogger::LogStream<Capacity> stream;
+        stream << "benchmark message " << i_ << " value " << 3.14159;
+        sink += stream.size();
+    }));
+    report_(stage(name + "_long", ops_, 1, [&sink, &padding](const size_t i_) {
+        MultiLogger::LogStream<Capacity> stream;
+        stream << "benchmark message " << i_ << " value " << 3.14159 << ' ' << padding;
+        sink += stream.size();
+    }));
+}
+
+/// Report formatting messages of numbers the ways the macros did and do.
+void formatNumeric(const size_t ops_, const std::function<void(Result&&)>& report_)
+{
+    struct Numbers
+    {
+        int         _count;
+        long long   _id;
+        double      _read;
+        double      _ratio;
+    };
+    std::mt19937 mt{42};
+    std::uniform_int_distribution<int> intDist{10000, 1000000000};
+    std::uniform_real_distribution<double> readDist{1.0, 10.0};
+    std::vector<Numbers> numbers(1024);
+    for (auto& n : numbers) {
+        n = Numbers{intDist(mt), -static_cast<long long>(intDist(mt)) * intDist(mt), readDist(mt), readDist(mt) / 3e5};
+    }
+    const auto message = [&numbers](std::ostream& out_, const size_t i_) {
+        const auto& n = numbers[i_ % numbers.size()];
+        out_ << i_ << ": count " << n._count << " id " << n._id << " read " << n._read << " ratio " << n._ratio;
+    };
+
+    size_t sink = 0;
+    report_(stage("format_numeric", ops_, 1, [&sink, &message](const size_t i_) {
+        MultiLogger::LogStream<> stream;
+        message(stream, i_);
+        sink += stream.size();
+    }));
+    report_(stage("format_numeric_facets", ops_, 1, [&sink, &message](const size_t i_) {
+        MultiLogger::LogStream<> stream;
+        stream.imbue(std::locale::classic());
+        message(stream, i_);
+        sink += stream.size();
+    }));
+    report_(stage("format_numeric_ostringstream", ops_, 1, [&sink, &message](const size_t i_) {
+        std::ostringstream stream;
+        message(stream, i_);
+        sink += stream.str().size();
+    }));
+}
+
+/// Measure the steps of the pipeline separately.
+void stages(const size_t ops_, const std::function<void(Result&&)>& report_)
+{
+    const auto batch = size_t{1024};
+    std::string sink;
+
+    report_(stage("format", ops_, 1, [&sink](const size_t i_) {
+        MultiLogger::LogStream<> stream;
+        stream << "benchmark message " << i_ << " value " << 3.14159;
+        sink.assign(stream.data(), stream.size());
+    }));
+#ifdef USING_CPP14
+    report_(stage("format_compiled", ops_, 1, [&sink](const size_t i_) {
+        static constexpr auto format = MultiLogger::imp::compileFormat<
+            MultiLogger::imp::formatShape("benchmark message {} value {}")._pieces>("benchmark message {} value {}");
+        MultiLogger::LogStream<> stream;
+        MultiLogger::imp::renderFormat(stream, format, "benchmark message {} value {}", i_, 3.14159);
+        sink.assign(stream.data(), stream.size());
+    }));
+#endif
+    report_(stage("format_fields", ops_, 1, [&sink](const size_t i_) {
+        MultiLogger::LogStream<> stream;
+        stream << "benchmark message" << MultiLogger::kv("index", i_) << MultiLogger::kv("value", 3.14159);
+        const auto fields = stream.fields();
+        sink.assign(stream.data(), stream.size());
+        sink.append(fields._data, fields._size);
+    }));
+    formatInline<64>(ops_, report_);
+    formatInline<256>(ops_, report_);
+    formatInline<1024>(ops_, report_);
+    formatNumeric(ops_, report_);
+    report_(stage("format_ostringstream", ops_, 1, [&sink](const size_t i_) {
+        sink = static_cast<std::ostringstream&>(std::ostringstream().flush() << "benchmark message " << i_ << " value " << 3.14159).str();
+    }));
+
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Info, "bench"};
+        log.addDest("null", MultiLogger::cpp14::imp::make_unique<MultiLogger::NullDest>());
+        const std::string message{"benchmark message 12345 value 3.14159"};
+        report_(stage("enqueue", ops_, 1, [&log, &message](const size_t) {
+            log(message.data(), message.size(), MultiLogger::Priority::Info, __FUNCTION__, __FILE__, __LINE__, std::this_thread::get_id());
+        }));
+        log.flush();
+    }
+
+    MultiLogger::LogSource source;
+    // short messages so copying them into the queue does not allocate
+    std::deque<std::string> texts;
+    const auto shortRecords = records(&source, batch, "msg ", texts);
+    MultiLogger::record_queue_t queue;
+    report_(stage("ordering", ops_ / batch, batch, [&queue, &shortRecords](const size_t) {
+        for (const auto& record : shortRecords) {
+            queue.push(record);
+        }
+        while (!queue.empty()) {
+            queue.pop();
+        }
+    }));
+
+    const std::string thread{"0"};
+    const MultiLogger::LineHeader header{"bench"};
+    const MultiLogger::Layout layout{MultiLogger::Layout::classic};
+    MultiLogger::LineFormatter formatter;
+    const auto fullPathRecords = records(&source, batch, "benchmark message value 3.14159 ", texts);
+    std::ostringstream rendered;
+    report_(stage("render_full_path", ops_ / batch, batch, [&rendered, &formatter, &header, &layout, &fullPathRecords, &thread](const size_t) {
+        rendered.str(std::string{});
+        for (const auto& record : fullPathRecords) {
+            formatter.format(*rendered.rdbuf(), record, header, thread, layout);
+        }
+    }));
+
+    const MultiLogger::Layout pattern{"[%p] %d %t %c %f: %m (%F:%L)"};
+    report_(stage("render_pattern", ops_ / batch, batch, [&rendered, &formatter, &header, &pattern, &fullPathRecords, &thread](const size_t) {
+        rendered.str(std::string{});
+        for (const auto& record : fullPathRecords) {
+            formatter.format(*rendered.rdbuf(), record, header, thread, pattern);
+        }
+    }));
+
+    // the same messages with their structured fields after their texts
+    auto fieldRecords = fullPathRecords;
+    for (auto i = size_t{0}; i < fieldRecords.size(); ++i) {
+        MultiLogger::LogStream<> stream;
+        stream << "benchmark message" << MultiLogger::kv("index", i) << MultiLogger::kv("value", 3.14159);
+        const auto fields = stream.fields();
+        texts.push_back(std::string{stream.data(), stream.size()} + std::string{fields._data, fields._size});
+        fieldRecords[i]._text = texts.back().data();
+        fieldRecords[i]._size = stream.size();
+        fieldRecords[i]._fields = static_cast<std::uint32_t>(fields._size);
+    }
+    report_(stage("render_fields", ops_ / batch, batch, [&rendered, &formatter, &header, &layout, &fieldRecords, &thread](const size_t) {
+        rendered.str(std::string{});
+        for (const auto& record : fieldRecords) {
+            formatter.format(*rendered.rdbuf(), record, header, thread, layout);
+        }
+    }));
+    const MultiLogger::Layout json{MultiLogger::Layout::json};
+    report_(stage("render_json", ops_ / batch, batch, [&rendered, &formatter, &header, &json, &fieldRecords, &thread](const size_t) {
+        rendered.str(std::string{});
+        for (const auto& record : fieldRecords) {
+            formatter.format(*rendered.rdbuf(), record, header, thread, json);
+        }
+    }));
+    {
+        // the messages refer to the context, the guard keeps it alive
+        const MultiLogger::ScopedContext request{MultiLogger::kv("index", 42), MultiLogger::kv("value", 3.14159)};
+        auto contextRecords = fullPathRecords;
+        for (auto& record : contextRecords) {
+            record._context = MultiLogger::currentContext();
+        }
+        report_(stage("render_context", ops_ / batch, batch, [&rendered, &formatter, &header, &layout, &contextRecords, &thread](const size_t) {
+            rendered.str(std::string{});
+            for (const auto& record : contextRecords) {
+                formatter.format(*rendered.rdbuf(), record, header, thread, layout);
+            }
+        }));
+    }
+
+#ifdef USING_CPP14
+    const auto batchRecords = records(&source, batch, "benchmark message value 3.14159 ", texts
+        , MultiLogger::imp::sourceFile(__FILE__));
+#else
+    const auto& batchRecords = fullPathRecords;
+#endif
+    report_(stage("render", ops_ / batch, batch, [&rendered, &formatter, &header, &layout, &batchRecords, &thread](const size_t) {
+        rendered.str(std::string{});
+        for (const auto& record : batchRecords) {
+            formatter.format(*rendered.rdbuf(), record, header, thread, layout);
+        }
+    }));
+
+    const auto text = rendered.str();
+    std::vector<MultiLogger::LogLine> lines;
+    for (auto begin = size_t{0}; begin < text.size(); ) {
+        const auto end = text.find('\n', begin) + 1;
+        lines.push_back(MultiLogger::LogLine{text.data() + begin, end - begin});
+        begin = end;
+    }
+    MultiLogger::NullDest null;
+    report_(stage("dispatch_null", ops_ / batch, batch, [&null, &lines](const size_t) {
+        null.write(lines.data(), lines.size());
+    }));
+    MultiLogger::CountingDest counting{true};
+    report_(stage("dispatch_checksum", ops_ / batch, batch, [&counting, &lines](const size_t) {
+        counting.write(lines.data(), lines.size());
+    }));
+}
+
+//=============================================================================
+
+/// @return the resident set size of the process in kB, 0 if unknown
+std::uint64_t residentKb()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.WorkingSetSize / 1024;
+    }
+#else
+    std::ifstream statm{"/proc/self/statm"};
+    std::uint64_t pages = 0;
+    std::uint64_t resident = 0;
+    if (statm >> pages >> resident) {
+        return resident * static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE)) / 1024;
+    }
+#endif
+    return 0;
+}
+
+/**
+ * Log messages of mixed sizes (mostly short, some long and a few too large
+ * for the blocks of the engine) from every thread at a steady total rate of
+ * msgsPerSecond_ for the given time. The resident memory is sampled every
+ * second: after the warm-up it should stay flat.
+ */
+Result soak(const size_t threads_, const size_t seconds_, const size_t msgsPerSecond_)
+{
+    MultiLogger::Logger log{MultiLogger::Priority::Info, "bench"};
+    log.addDest("counting", MultiLogger::cpp14::imp::make_unique<MultiLogger::CountingDest>());
+
+    const std::string medium(200, 'm');
+    const std::string large(20 * 1024, 'l');
+    const auto end = steady_clock_t::now() + std::chrono::seconds{seconds_};
+    const auto perThread = std::max<size_t>(1, msgsPerSecond_ / threads_);
+    const auto chunk = size_t{100};
+    std::atomic<std::uint64_t> logged{0};
+
+    std::vector<std::pair<double, double>> samples;
+    auto peakKb = std::uint64_t{0};
+    runThreads(threads_ + 1, [&](const size_t thread_) {
+        if (thread_ == threads_) {
+            const auto start = steady_clock_t::now();
+            while (steady_clock_t::now() < end) {
+                std::this_thread::sleep_for(std::chrono::seconds{1});
+                const auto kb = residentKb();
+                peakKb = std::max(peakKb, kb);
+                samples.emplace_back(static_cast<double>(nanosSince(start)) / 1e9, static_cast<double>(kb));
+            }
+            return;
+        }
+        auto next = steady_clock_t::now();
+        auto i = size_t{0};
+        while (next < end) {
+            for (auto c = size_t{0}; c < chunk; ++c, ++i) {
+                if (i % 1000 == 999) {
+                    MRLogInfoL(log, "large " << i << ' ' << large);
+                } else if (i % 10 == 9) {
+                    MRLogInfoL(log, "medium " << i << ' ' << medium);
+                } else {
+                    MRLogInfoL(log, "short " << i << " value " << 3.14159);
+                }
+            }
+            logged += chunk;
+            next += std::chrono::nanoseconds{static_cast<std::int64_t>(1e9 * static_cast<double>(chunk) / static_cast<double>(perThread))};
+            std::this_thread::sleep_until(next);
+        }
+    });
+    log.flush();
+    const auto stats = log.stats();
+
+    // growth of the memory after the first tenth of the run, least squares
+    const auto warmUp = samples.size() / 10;
+    auto n = 0.0, sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+    for (auto i = warmUp; i < samples.size(); ++i) {
+        n += 1;
+        sx += samples[i].first;
+        sy += samples[i].second;
+        sxx += samples[i].first * samples[i].first;
+        sxy += samples[i].first * samples[i].second;
+    }
+    const auto slope = (n > 1 && n * sxx != sx * sx) ? (n * sxy - sx * sy) / (n * sxx - sx * sx) : 0.0;
+
+    Result result;
+    result._name = "soak/counting";
+    result.add("threads", static_cast<double>(threads_));
+    result.add("seconds", static_cast<double>(seconds_));
+    result.add("ops", static_cast<double>(logged.load()));
+    result.add("rss_start_kb", samples.empty() ? 0.0 : samples[warmUp].second);
+    result.add("rss_peak_kb", static_cast<double>(peakKb));
+    result.add("rss_end_kb", samples.empty() ? 0.0 : samples.back().second);
+    result.add("rss_growth_kb_per_hour", slope * 3600);
+    result.add("peak_queue_depth", static_cast<double>(stats._peakQueueDepth));
+    result.add("arena_kb", static_cast<double>(stats._arenaBytes) / 1024);
+    // memory reserved for the texts per queued message at the peak
+    result.add("arena_bytes_per_queued_msg", static_cast<double>(stats._arenaBytes) / static_cast<double>(std::max<std::uint64_t>(1, stats._peakQueueDepth)));
+    return result;
+}
+
+//=============================================================================
+
+Options parse(const int argc_, char* argv_[])
+{
+    Options options;
+    for (auto i = 1; i < argc_; ++i) {
+        const std::string arg{argv_[i]};
+        if (arg == "--quick") {
+            options._quick = true;
+        } else if (arg == "--allocations") {
+            options._allocations = true;
+        } else if (arg == "--threads" && i + 1 < argc_) {
+            options._maxThreads = static_cast<size_t>(std::max(1, std::atoi(argv_[++i])));
+        } else if (arg == "--soak" && i + 1 < argc_) {
+            options._soakSeconds = static_cast<size_t>(std::max(0, std::atoi(argv_[++i])));
+        } else if (arg == "--out" && i + 1 < argc_) {
+            options._out = argv_[++i];
+        } else {
+            throw std::runtime_error("usage: " + std::string{argv_[0]} + " [--quick] [--allocations] [--threads N] [--soak SECONDS] [--out results.json]");
+        }
+    }
+    return options;
+}
+
+results_t run(const Options& options_)
+{
+    const auto scale = options_._quick ? size_t{1} : size_t{10};
+    const auto ops = 20000 * scale;
+    const std::string fileName{"benchmark_file.log"};
+
+    if (options_._allocations) {
+        allocationHook(&countProcess);
+    }
+
+    results_t results;
+    const auto report = [&results](Result&& result_) {
+        std::cerr << result_ << std::endl;
+        results.push_back(std::move(result_));
+    };
+
+    stages(ops, report);
+    report(disabled("threshold", true, 100 * ops));
+    report(disabled("no_destination", false, 100 * ops));
+    for (const auto threads : threadCounts(options_._maxThreads)) {
+        report(throughput("null", MultiLogger::cpp14::imp::make_unique<MultiLogger::NullDest>(), threads, ops / threads, options_._allocations));
+    }
+    for (const auto threads : threadCounts(options_._maxThreads)) {
+        report(throughput("counting", MultiLogger::cpp14::imp::make_unique<MultiLogger::CountingDest>(true), threads, ops / threads, options_._allocations));
+    }
+    for (const auto threads : threadCounts(options_._maxThreads)) {
+        report(throughput("file", MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(fileName), threads, ops / threads, options_._allocations));
+        std::remove(fileName.c_str());
+    }
+    report(throughput("stdout", MultiLogger::cpp14::imp::make_unique<MultiLogger::StdOutDest>(), 1, ops / 10, options_._allocations));
+    report(throughput("stdout", MultiLogger::cpp14::imp::make_unique<MultiLogger::StdOutDest>(), options_._maxThreads, ops / 10 / options_._maxThreads, options_._allocations));
+    for (const auto threads : threadCounts(options_._maxThreads)) {
+        report(callLatency(threads, ops / threads));
+    }
+    if (options_._soakSeconds > 0) {
+        report(soak(options_._maxThreads, options_._soakSeconds, 50000));
+    }
+    return results;
+}
+
+void write(const std::string& fileName_, const Options& options_, const results_t& results_)
+{
+    std::ofstream out{fileName_};
+    if (!out) {
+        throw std::runtime_error("cannot open file " + fileName_ + " for the results!");
+    }
+    const auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    struct tm tm;
+    if (!gmtime_r(&now, &tm)) {
+        throw std::runtime_error("cannot get time for the results!");
+    }
+    out << "{\n  \"library\": \"MultiLogger\",\n  \"time\": \"" << std::put_time(&tm, "%Y-%m-%dT%H:%M:%SZ")
+        << "\",\n  \"hardware_concurrency\": " << std::thread::hardware_concurrency()
+        << ",\n  \"max_threads\": " << options_._maxThreads
+        << ",\n  \"quick\": " << (options_._quick ? "true" : "false")
+        << ",\n  \"allocations\": " << (options_._allocations ? "true" : "false")
+        << ",\n  \"results\": [";
+    for (auto i = size_t{0}; i < results_.size(); ++i) {
+        out << (i == 0 ? "\n    " : ",\n    ") << results_[i];
+    }
+    out << "\n  ]\n}\n";
+}
+
+}
+
+} // namespace LogBenchmark
+
+int main(int argc, char* argv[])
+{
+    try {
+        const auto options = LogBenchmark::parse(argc, argv);
+        LogBenchmark::write(options._out, options, LogBenchmark::run(options));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -5,6 +5,14 @@
 
 #include <fstream>
 #include <cstdio>
+#include <limits>
+#include <functional>
+#include <iomanip>
+#include <regex>
+#include <sstream>
+#include <cmath>
+#include <future>
+#include <cctype>
 
 TEST_CASE("Debug logger", "[debugger]")
 {
@@ -79,9 +87,12 @@ TEST_CASE("Set category", "[set-category]")
         MultiLogger::Logger log{MultiLogger::Priority::Debug, category};
         log.addDest(testFile, MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(testFile));
         REQUIRE_THAT(log.category(), Catch::Matchers::Equals(category));
+        const auto previous = log.category();
         category = "debuggger";
         log.category(category);
         REQUIRE_THAT(log.category(), Catch::Matchers::Equals(category));
+        // the returned category does not depend on the replaced snapshot
+        CHECK(previous == "debugger");
         MRLogL(log, MultiLogger::Priority::Debug, testFile);
     }
     {
@@ -188,3 +199,1178 @@ TEST_CASE("Set threshold", "[set-thresh]")
     }
     std::remove(testFile.c_str());
 }
+
+TEST_CASE("Flush", "[flush]")
+{
+    const std::string testFile{"test9"};
+    std::string category{"flush"};
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Info, category};
+        log.addDest(testFile, MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(testFile));
+        MRLogInfoL(log, testFile);
+        log.flush();
+        {
+            std::fstream t{testFile, std::ios_base::in};
+            CHECK(static_cast<bool>(t));
+            std::string line;
+            CHECK(static_cast<bool>(std::getline(t, line)));
+            REQUIRE_THAT(line,
+                Catch::Matchers::Contains(category) && Catch::Matchers::Contains("Info: ") && Catch::Matchers::Contains(testFile));
+        }
+        MRLogWarningL(log, testFile);
+        CHECK(log.flush(std::chrono::milliseconds{5000}));
+        {
+            std::fstream t{testFile, std::ios_base::in};
+            CHECK(static_cast<bool>(t));
+            std::string line;
+            CHECK(static_cast<bool>(std::getline(t, line)));
+            CHECK(static_cast<bool>(std::getline(t, line)));
+            REQUIRE_THAT(line,
+                Catch::Matchers::Contains(category) && Catch::Matchers::Contains("Warning: ") && Catch::Matchers::Contains(testFile));
+        }
+    }
+    std::remove(testFile.c_str());
+}
+
+TEST_CASE("Destination thresholds", "[dest-thresh]")
+{
+    const std::string testFile1{"test10"};
+    const std::string testFile2{"test11"};
+    std::string category{"routes"};
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Debug, category};
+        log.addDest(testFile1, MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(testFile1));
+        log.addDest(testFile2, MultiLogger::Priority::Warning, MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(testFile2));
+        MRLogDebugL(log, testFile1);
+        MRLogWarningL(log, testFile2);
+        log.flush();
+        log.permitDest(testFile1, false);
+        log.threshold(testFile2, MultiLogger::Priority::Debug);
+        MRLogDebugL(log, testFile2);
+    }
+    {
+        std::fstream t{testFile1, std::ios_base::in};
+        CHECK(static_cast<bool>(t));
+        std::string line;
+        CHECK(static_cast<bool>(std::getline(t, line)));
+        REQUIRE_THAT(line, Catch::Matchers::Contains("Debug: ") && Catch::Matchers::Contains(testFile1));
+        CHECK(static_cast<bool>(std::getline(t, line)));
+        REQUIRE_THAT(line, Catch::Matchers::Contains("Warning: ") && Catch::Matchers::Contains(testFile2));
+        CHECK_FALSE(static_cast<bool>(std::getline(t, line)));
+    }
+    {
+        std::fstream t{testFile2, std::ios_base::in};
+        CHECK(static_cast<bool>(t));
+        std::string line;
+        CHECK(static_cast<bool>(std::getline(t, line)));
+        REQUIRE_THAT(line, Catch::Matchers::Contains("Warning: ") && Catch::Matchers::Contains(testFile2));
+        CHECK(static_cast<bool>(std::getline(t, line)));
+        REQUIRE_THAT(line, Catch::Matchers::Contains("Debug: ") && Catch::Matchers::Contains(testFile2));
+        CHECK_FALSE(static_cast<bool>(std::getline(t, line)));
+    }
+    std::remove(testFile1.c_str());
+    std::remove(testFile2.c_str());
+}
+
+TEST_CASE("Skip messages no destination accepts", "[accepts]")
+{
+    const std::string testFile{"test12"};
+    std::string category{"accepts"};
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Debug, category};
+        CHECK_FALSE(log.accepts(MultiLogger::Priority::Critical));
+        log.addDest(testFile, MultiLogger::Priority::Warning, MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(testFile));
+        CHECK(log.logging(MultiLogger::Priority::Debug));
+        CHECK_FALSE(log.accepts(MultiLogger::Priority::Info));
+        CHECK(log.accepts(MultiLogger::Priority::Warning));
+        auto evaluated = 0;
+        MRLogInfoL(log, testFile << ++evaluated);
+        CHECK(evaluated == 0);
+        MRLogErrorL(log, testFile << ++evaluated);
+        CHECK(evaluated == 1);
+        log.permitDest(testFile, false);
+        CHECK_FALSE(log.accepts(MultiLogger::Priority::Critical));
+        log.permitDest(testFile, true);
+        log.threshold(MultiLogger::Priority::Critical);
+        CHECK_FALSE(log.accepts(MultiLogger::Priority::Error));
+    }
+    std::remove(testFile.c_str());
+}
+
+TEST_CASE("Reconfigure while logging", "[reconfigure]")
+{
+    const std::string testFile{"test13"};
+    std::string category{"reconfigure"};
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Debug, category};
+        log.addDest(testFile, MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(testFile));
+        std::thread toggler{[&log, &testFile]() {
+            for (auto i = 0; i < 100; ++i) {
+                log.permitDest(testFile, i % 2 == 1);
+                CHECK(log.logging(testFile) == (i % 2 == 1));
+            }
+        }};
+        for (auto i = 0; i < 100; ++i) {
+            MRLogDebugL(log, testFile << ' ' << i);
+        }
+        toggler.join();
+        log.flush();
+        CHECK(log.logging(testFile));
+        MRLogCriticalL(log, testFile);
+    }
+    {
+        std::fstream t{testFile, std::ios_base::in};
+        CHECK(static_cast<bool>(t));
+        std::string line, last;
+        while (std::getline(t, line)) {
+            last = line;
+        }
+        REQUIRE_THAT(last, Catch::Matchers::Contains("Critical: ") && Catch::Matchers::Contains(testFile));
+    }
+    std::remove(testFile.c_str());
+}
+
+TEST_CASE("Shared engine", "[shared-engine]")
+{
+    const std::string testFile1{"test14"};
+    const std::string testFile2{"test15"};
+    {
+        auto engine = std::make_shared<MultiLogger::LoggingEngine>();
+        MultiLogger::Logger log1{engine, MultiLogger::Priority::Debug, "first"};
+        log1.addDest(testFile1, MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(testFile1));
+        {
+            MultiLogger::Logger log2{engine, MultiLogger::Priority::Debug, "second"};
+            log2.addDest(testFile2, MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(testFile2));
+            MRLogInfoL(log1, testFile1);
+            MRLogWarningL(log2, testFile2);
+        }
+        engine->flush();
+        {
+            std::fstream t{testFile1, std::ios_base::in};
+            CHECK(static_cast<bool>(t));
+            std::string line;
+            CHECK(static_cast<bool>(std::getline(t, line)));
+            REQUIRE_THAT(line,
+                Catch::Matchers::Contains("first") && Catch::Matchers::Contains("Info: ") && Catch::Matchers::Contains(testFile1));
+        }
+        {
+            std::fstream t{testFile2, std::ios_base::in};
+            CHECK(static_cast<bool>(t));
+            std::string line;
+            CHECK(static_cast<bool>(std::getline(t, line)));
+            REQUIRE_THAT(line,
+                Catch::Matchers::Contains("second") && Catch::Matchers::Contains("Warning: ") && Catch::Matchers::Contains(testFile2));
+        }
+    }
+    std::remove(testFile1.c_str());
+    std::remove(testFile2.c_str());
+}
+
+TEST_CASE("Shared destination", "[shared-dest]")
+{
+    const std::string testFile{"test16"};
+    {
+        auto engine = std::make_shared<MultiLogger::LoggingEngine>();
+        auto dest = std::make_shared<MultiLogger::FileDest>(testFile);
+        MultiLogger::Logger log1{engine, MultiLogger::Priority::Debug, "first"};
+        MultiLogger::Logger log2{engine, MultiLogger::Priority::Debug, "second"};
+        MultiLogger::Logger log3{MultiLogger::Priority::Debug, "third"};
+        log1.addDest(testFile, dest);
+        log2.addDest(testFile, MultiLogger::Priority::Info, dest);
+        log3.addDest(testFile, dest);
+        MRLogInfoL(log1, testFile);
+        MRLogDebugL(log2, testFile);
+        MRLogInfoL(log2, testFile);
+        log1.flush();
+        MRLogInfoL(log3, testFile);
+    }
+    {
+        std::fstream t{testFile, std::ios_base::in};
+        CHECK(static_cast<bool>(t));
+        std::string line;
+        CHECK(static_cast<bool>(std::getline(t, line)));
+        REQUIRE_THAT(line, Catch::Matchers::Contains("first") && Catch::Matchers::Contains("Info: "));
+        CHECK(static_cast<bool>(std::getline(t, line)));
+        REQUIRE_THAT(line, Catch::Matchers::Contains("second") && Catch::Matchers::Contains("Info: "));
+        CHECK(static_cast<bool>(std::getline(t, line)));
+        REQUIRE_THAT(line, Catch::Matchers::Contains("third") && Catch::Matchers::Contains("Info: "));
+        CHECK_FALSE(static_cast<bool>(std::getline(t, line)));
+    }
+    std::remove(testFile.c_str());
+}
+
+TEST_CASE("Rate limits", "[rate-limit]")
+{
+    const std::string testFile{"test17"};
+    std::string category{"limits"};
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Debug, category};
+        log.addDest(testFile, MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(testFile));
+        for (auto i = 0; i < 100; ++i) {
+            MRLogLimitL(log, MultiLogger::Priority::Info, MultiLogger::RateLimit::everyNth(10), "every 10th " << i);
+        }
+        for (auto i = 0; i < 100; ++i) {
+            MRLogLimitL(log, MultiLogger::Priority::Info, MultiLogger::RateLimit::perSecond(1, 5), "per second " << i);
+        }
+        log.rateLimit(MultiLogger::Priority::Debug, MultiLogger::RateLimit::everyNth(50));
+        for (auto i = 0; i < 100; ++i) {
+            MRLogDebugL(log, "global " << i);
+        }
+    }
+    {
+        std::fstream t{testFile, std::ios_base::in};
+        CHECK(static_cast<bool>(t));
+        auto everyNth = 0;
+        auto perSecond = 0;
+        auto global = 0;
+        auto suppressed = 0;
+        auto remaining = 0;
+        std::string line;
+        while (std::getline(t, line)) {
+            everyNth += (line.find("every 10th") != std::string::npos);
+            perSecond += (line.find("per second") != std::string::npos);
+            global += (line.find("global") != std::string::npos);
+            suppressed += (line.find(" (9 similar messages suppressed)") != std::string::npos);
+            // the counts left at the end are logged when the logger is destroyed
+            remaining += (line.find(" Info: 9 similar messages suppressed (unittest.cpp:") != std::string::npos);
+            remaining += (line.find(" Info: 95 similar messages suppressed (unittest.cpp:") != std::string::npos);
+            remaining += (line.find(" Debug: 49 similar messages suppressed (unittest.cpp:") != std::string::npos);
+        }
+        CHECK(everyNth == 10);
+        CHECK(perSecond == 5);
+        CHECK(global == 2);
+        CHECK(suppressed == 9);
+        CHECK(remaining == 3);
+    }
+    std::remove(testFile.c_str());
+}
+
+namespace
+{
+
+/// Remembers where the lines it was given are.
+struct ViewDest : MultiLogger::LogDest
+{
+    void write(const std::string&) override
+    {}
+    void write(const MultiLogger::LogLine* lines_, const size_t count_) override
+    {
+        for (auto i = size_t{0}; i < count_; ++i) {
+            _views.push_back(lines_[i]._data);
+            _lines.emplace_back(lines_[i]._data, lines_[i]._size);
+        }
+    }
+    void flush() override
+    {}
+
+    std::vector<const char*>    _views;
+    std::vector<std::string>    _lines;
+};
+
+}
+
+TEST_CASE("Deduplicate repeated messages", "[dedup]")
+{
+    const std::string testFile1{"test18"};
+    const std::string testFile2{"test19"};
+    std::string category{"dedup"};
+    auto terse = std::make_shared<ViewDest>();
+    terse->layout("%p %c: %m");
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Debug, category};
+        log.addDest(testFile1, MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(testFile1));
+        log.addDest(testFile2, MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(testFile2));
+        log.dedup(testFile1, std::chrono::milliseconds{60 * 1000});
+        log.addDest("terse", terse);
+        log.dedup("terse", std::chrono::milliseconds{60 * 1000});
+        for (auto i = 0; i < 10; ++i) {
+            MRLogInfoL(log, "the same");
+        }
+        MRLogInfoL(log, "something else");
+        for (auto i = 0; i < 5; ++i) {
+            MRLogInfoL(log, "the same");
+        }
+    }
+    {
+        std::fstream t{testFile1, std::ios_base::in};
+        CHECK(static_cast<bool>(t));
+        std::string line;
+        CHECK(static_cast<bool>(std::getline(t, line)));
+        REQUIRE_THAT(line, Catch::Matchers::Contains("the same"));
+        CHECK(static_cast<bool>(std::getline(t, line)));
+        // the summary is a line of the repeated message in the layout of the destination
+        REQUIRE_THAT(line, Catch::Matchers::Contains(" dedup ")
+            && Catch::Matchers::Contains(" Info: last message repeated 9 times (unittest.cpp:"));
+        CHECK(static_cast<bool>(std::getline(t, line)));
+        REQUIRE_THAT(line, Catch::Matchers::Contains("something else"));
+        CHECK(static_cast<bool>(std::getline(t, line)));
+        REQUIRE_THAT(line, Catch::Matchers::Contains("the same"));
+        CHECK(static_cast<bool>(std::getline(t, line)));
+        REQUIRE_THAT(line, Catch::Matchers::Contains(" Info: last message repeated 4 times (unittest.cpp:"));
+        CHECK_FALSE(static_cast<bool>(std::getline(t, line)));
+    }
+    {
+        std::fstream t{testFile2, std::ios_base::in};
+        CHECK(static_cast<bool>(t));
+        auto count = 0;
+        std::string line;
+        while (std::getline(t, line)) {
+            ++count;
+        }
+        CHECK(count == 16);
+    }
+    CHECK(terse->_lines == (std::vector<std::string>{"Info dedup: the same\n", "Info dedup: last message repeated 9 times\n"
+        , "Info dedup: something else\n", "Info dedup: the same\n", "Info dedup: last message repeated 4 times\n"}));
+    std::remove(testFile1.c_str());
+    std::remove(testFile2.c_str());
+
+    // replacing or disabling the filter keeps its pending repeats
+    auto changed = std::make_shared<ViewDest>();
+    changed->layout("%p: %m");
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Debug, category};
+        log.addDest("changed", changed);
+        log.dedup("changed", std::chrono::milliseconds{60 * 1000});
+        const auto waitDeduplicated = [&log](const std::uint64_t count_) {
+            while (log.stats()._dests[0]._deduplicated < count_) {
+                std::this_thread::yield();
+            }
+        };
+        for (auto i = 0; i < 3; ++i) {
+            MRLogInfoL(log, "first");
+        }
+        waitDeduplicated(2);
+        log.dedup("changed", std::chrono::milliseconds{30 * 1000});
+        for (auto i = 0; i < 4; ++i) {
+            MRLogInfoL(log, "second");
+        }
+        waitDeduplicated(5);
+        log.dedup("changed", std::chrono::milliseconds{0});
+        MRLogInfoL(log, "third");
+    }
+    CHECK(changed->_lines == (std::vector<std::string>{"Info: first\n", "Info: last message repeated 2 times\n"
+        , "Info: second\n", "Info: last message repeated 3 times\n", "Info: third\n"}));
+}
+
+TEST_CASE("Statistics", "[stats]")
+{
+    const std::string testFile{"test20"};
+    std::string category{"stats"};
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Info, category};
+        log.addDest(testFile, MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(testFile));
+        log.dedup(testFile, std::chrono::milliseconds{60 * 1000});
+        for (auto i = 0; i < 10; ++i) {
+            MRLogInfoL(log, "message " << i);
+            MRLogDebugL(log, "below threshold " << i);
+            MRLogLimitL(log, MultiLogger::Priority::Warning, MultiLogger::RateLimit::everyNth(5), "limited " << i);
+        }
+        for (auto i = 0; i < 10; ++i) {
+            MRLogErrorL(log, "the same");
+        }
+        log.flush();
+
+        const auto stats = log.stats();
+        CHECK(stats._accepted[static_cast<size_t>(MultiLogger::Priority::Info)] == 10);
+        CHECK(stats._accepted[static_cast<size_t>(MultiLogger::Priority::Warning)] == 2);
+        CHECK(stats._accepted[static_cast<size_t>(MultiLogger::Priority::Error)] == 10);
+        CHECK(stats._rejected[static_cast<size_t>(MultiLogger::Priority::Debug)] == 10);
+        CHECK(stats._suppressed[static_cast<size_t>(MultiLogger::Priority::Warning)] == 8);
+        CHECK(stats._queueDepth == 0);
+        CHECK(stats._peakQueueDepth > 0);
+        // with the 4 messages suppressed after the last limited one, reported by flush()
+        CHECK(stats._latency._count == 23);
+        CHECK(stats._latency.percentile(0.5) <= stats._latency.percentile(0.99));
+        CHECK(stats._latency.percentile(1.0) == stats._latency._max);
+        REQUIRE(stats._dests.size() == 1);
+        CHECK(stats._dests[0]._name == testFile);
+        CHECK(stats._dests[0]._lines == 15);
+        CHECK(stats._dests[0]._bytes > 0);
+        CHECK(stats._dests[0]._deduplicated == 9);
+    }
+    std::remove(testFile.c_str());
+    CHECK(MultiLogger::LatencyHistogram::bucketOf(7) == 7);
+    CHECK(MultiLogger::LatencyHistogram::highestOf(MultiLogger::LatencyHistogram::bucketOf(1000)) >= 1000);
+    CHECK(MultiLogger::LatencyHistogram::bucketOf(~std::uint64_t{0}) == MultiLogger::LatencyHistogram::buckets - 1);
+}
+
+TEST_CASE("Statistics while reconfiguring", "[stats]")
+{
+    MultiLogger::Logger log{MultiLogger::Priority::Info, "reconfigure"};
+    log.addDest("null", MultiLogger::cpp14::imp::make_unique<MultiLogger::NullDest>());
+    log.addDest("other", MultiLogger::cpp14::imp::make_unique<MultiLogger::NullDest>());
+    std::atomic<bool> done{false};
+    std::thread toggler{[&log, &done]() {
+        for (auto i = 0; i < 2000; ++i) {
+            log.permitDest("other", (i % 2) != 0);
+        }
+        done = true;
+    }};
+    auto snapshots = 0;
+    auto wrong = 0;
+    while (!done || snapshots == 0) {
+        const auto stats = log.stats();
+        wrong += (stats._dests.size() != 2) || (stats._dests[1]._name != "other");
+        ++snapshots;
+    }
+    toggler.join();
+    CHECK(wrong == 0);
+    CHECK(log.logging("other"));
+}
+
+TEST_CASE("Null and counting destinations", "[counting-dest]")
+{
+    std::string category{"counting"};
+    auto counting = std::make_shared<MultiLogger::CountingDest>(true);
+    auto sameOrder = std::make_shared<MultiLogger::CountingDest>(true);
+    auto noChecksum = std::make_shared<MultiLogger::CountingDest>();
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Debug, category};
+        log.addDest("null", MultiLogger::cpp14::imp::make_unique<MultiLogger::NullDest>());
+        log.addDest("counting", counting);
+        log.addDest("same order", sameOrder);
+        log.addDest("no checksum", MultiLogger::Priority::Error, noChecksum);
+        for (auto i = 0; i < 10; ++i) {
+            MRLogInfoL(log, "message " << i);
+        }
+        MRLogErrorL(log, "error");
+    }
+    CHECK(counting->lines() == 11);
+    CHECK(counting->bytes() > 0);
+    CHECK(counting->checksum() != 0);
+    CHECK(sameOrder->lines() == counting->lines());
+    CHECK(sameOrder->bytes() == counting->bytes());
+    CHECK(sameOrder->checksum() == counting->checksum());
+    CHECK(noChecksum->lines() == 1);
+    CHECK(noChecksum->checksum() == 0);
+}
+
+TEST_CASE("Queued message memory", "[arena]")
+{
+    const std::string testFile{"test21"};
+    std::string category{"arena"};
+    const std::string large(20 * 1024, 'l');
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Info, category};
+        log.addDest(testFile, MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(testFile));
+        std::thread other{[&log]() {
+            for (auto i = 0; i < 1000; ++i) {
+                MRLogInfoL(log, "other " << i);
+            }
+        }};
+        for (auto i = 0; i < 1000; ++i) {
+            MRLogInfoL(log, "main " << i << ' ' << std::string(100, 'm'));
+        }
+        MRLogInfoL(log, "large " << large);
+        other.join();
+        log.flush();
+        CHECK(log.stats()._arenaBytes > 0);
+    }
+    {
+        std::fstream t{testFile, std::ios_base::in};
+        CHECK(static_cast<bool>(t));
+        auto main = 0;
+        auto other = 0;
+        auto largeFound = false;
+        std::string line;
+        while (std::getline(t, line)) {
+            main += (line.find("main " + std::to_string(main) + ' ' + std::string(100, 'm') + " (") != std::string::npos);
+            other += (line.find("other " + std::to_string(other) + " (") != std::string::npos);
+            largeFound |= (line.find("large " + large + " (") != std::string::npos);
+        }
+        CHECK(main == 1000);
+        CHECK(other == 1000);
+        CHECK(largeFound);
+    }
+    std::remove(testFile.c_str());
+}
+
+namespace
+{
+
+struct CountingResource : public MultiLogger::cpp17::pmr::memory_resource
+{
+    std::atomic_size_t      _allocated{0};
+    std::atomic_size_t      _outstanding{0};
+
+private:
+    void* do_allocate(size_t bytes_, size_t alignment_) override
+    {
+        _allocated += bytes_;
+        _outstanding += bytes_;
+        return MultiLogger::cpp17::pmr::new_delete_resource()->allocate(bytes_, alignment_);
+    }
+    void do_deallocate(void* p_, size_t bytes_, size_t alignment_) override
+    {
+        _outstanding -= bytes_;
+        MultiLogger::cpp17::pmr::new_delete_resource()->deallocate(p_, bytes_, alignment_);
+    }
+    bool do_is_equal(const MultiLogger::cpp17::pmr::memory_resource& other_) const noexcept override
+    {
+        return this == &other_;
+    }
+};
+
+}
+
+TEST_CASE("Memory resource", "[memory-resource]")
+{
+    std::string category{"resource"};
+    CountingResource resource;
+    auto counting = std::make_shared<MultiLogger::CountingDest>();
+    {
+        auto engine = std::make_shared<MultiLogger::LoggingEngine>(&resource);
+        MultiLogger::Logger log{engine, MultiLogger::Priority::Debug, category};
+        log.addDest("counting", counting);
+        for (auto i = 0; i < 100; ++i) {
+            MRLogInfoL(log, "message " << i);
+        }
+        MRLogInfoL(log, "large " << std::string(20 * 1024, 'l'));
+        log.flush();
+        CHECK(resource._allocated > 20 * 1024);
+        CHECK(resource._outstanding > 0);
+    }
+    CHECK(counting->lines() == 101);
+    CHECK(resource._outstanding == 0);
+}
+
+TEST_CASE("Inline log stream", "[inline-stream]")
+{
+    MultiLogger::LogStream<16> stream;
+    stream << "short " << 42;
+    CHECK(std::string(stream.data(), stream.size()) == "short 42");
+    const std::string tail(100, 't');
+    stream << ' ' << tail << '!';
+    CHECK(std::string(stream.data(), stream.size()) == "short 42 " + tail + '!');
+
+    std::string category{"inline"};
+    std::string testFile{"test22.log"};
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Debug, category};
+        log.addDest("file", MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(testFile));
+        MRLogInfoL(log, "fits " << 1);
+        MRLogInfoL(log, "spills " << std::string(2 * MULTILOGGER_INLINE_CAPACITY, 's'));
+    }
+    {
+        std::ifstream t(testFile);
+        std::string line;
+        REQUIRE(std::getline(t, line));
+        CHECK(line.find("fits 1 (") != std::string::npos);
+        REQUIRE(std::getline(t, line));
+        CHECK(line.find("spills " + std::string(2 * MULTILOGGER_INLINE_CAPACITY, 's') + " (") != std::string::npos);
+    }
+    std::remove(testFile.c_str());
+}
+
+TEST_CASE("Numeric formatting", "[numeric]")
+{
+    const auto check = [](const std::function<void(std::ostream&)>& write_) {
+        MultiLogger::LogStream<> fast;
+        std::ostringstream standard;
+        standard.imbue(std::locale::classic());
+        write_(fast);
+        write_(standard);
+        CHECK(std::string(fast.data(), fast.size()) == standard.str());
+    };
+    check([](std::ostream& o_) { o_ << 0 << ' ' << -1 << ' ' << 42u << ' ' << -9223372036854775807LL - 1 << ' ' << 18446744073709551615ULL; });
+    check([](std::ostream& o_) { o_ << static_cast<short>(-7) << ' ' << 123456789L << ' ' << true; });
+    check([](std::ostream& o_) { o_ << 3.14159265 << ' ' << -0.0 << ' ' << 1e300 << ' ' << 1.5e-300 << ' ' << 100000.0 << ' ' << 1234567.0; });
+    check([](std::ostream& o_) { o_ << 0.1f << ' ' << 2.5 << ' ' << 1e16 << ' ' << std::numeric_limits<double>::infinity(); });
+    check([](std::ostream& o_) { o_ << std::fixed << std::setprecision(2) << 3.14159 << ' ' << 1e20 << std::scientific << ' ' << 0.000123; });
+    check([](std::ostream& o_) { o_ << std::setprecision(17) << 0.1 << ' ' << std::setprecision(0) << 2.5; });
+    check([](std::ostream& o_) { o_ << std::hex << 255 << ' ' << std::showbase << 255 << std::oct << ' ' << 8 << std::dec; });
+    check([](std::ostream& o_) { o_ << std::setw(8) << std::setfill('0') << 42 << ' ' << std::showpos << 42 << ' ' << 1.5; });
+    check([](std::ostream& o_) { o_ << std::uppercase << std::scientific << 1e10 << ' ' << std::showpoint << std::defaultfloat << 2.0; });
+}
+
+TEST_CASE("Format strings", "[format]")
+{
+    static_assert(MultiLogger::imp::formatShape("user {} age {}")._slots == 2, "two arguments");
+    static_assert(MultiLogger::imp::formatShape("{{}}")._slots == 0, "escaped braces");
+    static_assert(!MultiLogger::imp::formatShape("user { age")._valid, "unmatched brace");
+    static_assert(!MultiLogger::imp::formatShape("user {0}")._valid, "no indices");
+
+    std::string category{"format"};
+    std::string testFile{"test23.log"};
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Info, category};
+        log.addDest(testFile, MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(testFile));
+        const std::string name{"Alice"};
+        MRLogf(log, MultiLogger::Priority::Info, "user {} age {} ratio {}", name, 42, 0.5);
+        MRLogf(log, MultiLogger::Priority::Info, "{{literal}} {}{}", 'x', "y");
+        MRLogf(log, MultiLogger::Priority::Info, "no arguments");
+        MRLogf(log, MultiLogger::Priority::Debug, "below the threshold {}", 1);
+    }
+    {
+        std::ifstream t(testFile);
+        std::string line;
+        REQUIRE(std::getline(t, line));
+        CHECK(line.find(": user Alice age 42 ratio 0.5 (") != std::string::npos);
+        REQUIRE(std::getline(t, line));
+        CHECK(line.find(": {literal} xy (") != std::string::npos);
+        REQUIRE(std::getline(t, line));
+        CHECK(line.find(": no arguments (") != std::string::npos);
+        CHECK_FALSE(std::getline(t, line));
+    }
+    std::remove(testFile.c_str());
+}
+
+namespace
+{
+
+/// Names a member in a deferred message, which captures this.
+struct DeferredWidget
+{
+    void log(MultiLogger::Logger& log_) const
+    {
+        MRLogDeferredL(log_, MultiLogger::Priority::Info, "widget " << _value);
+    }
+
+    int _value;
+};
+
+}
+
+TEST_CASE("Lazy and deferred messages", "[lazy]")
+{
+    std::string category{"lazy"};
+    std::string testFile{"test24.log"};
+    auto calls = 0;
+    std::thread::id renderThread;
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Info, category};
+        log.addDest(testFile, MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(testFile));
+        const auto expensive = [&calls]() { ++calls; return std::string{"expensive"}; };
+        MRLogDebugL(log, "skipped " << MultiLogger::lazy(expensive));
+        CHECK(calls == 0);
+        MRLogInfoL(log, "now " << MultiLogger::lazy(expensive));
+        CHECK(calls == 1);
+
+        const auto values = std::make_shared<std::vector<int>>(std::vector<int>{1, 2, 3});
+        auto rendered = std::make_shared<std::thread::id>();
+        MRLogDeferredL(log, MultiLogger::Priority::Info, "deferred " << MultiLogger::lazy([values, rendered]() {
+            *rendered = std::this_thread::get_id();
+            return values->size();
+        }));
+        MRLogDeferredL(log, MultiLogger::Priority::Debug, "skipped " << MultiLogger::lazy(expensive));
+        MRLogDeferredL(log, MultiLogger::Priority::Warning, "failing " << MultiLogger::lazy([]() -> int {
+            throw std::runtime_error{"no value"};
+        }));
+        MRLogDeferredL(log, MultiLogger::Priority::Warning, "odd " << MultiLogger::lazy([]() -> int {
+            throw 42;
+        }));
+        const DeferredWidget widget{7};
+        widget.log(log);
+        log.flush();
+        renderThread = *rendered;
+    }
+    CHECK(calls == 1);
+    CHECK(renderThread != std::thread::id{});
+    CHECK(renderThread != std::this_thread::get_id());
+    {
+        std::ifstream t(testFile);
+        std::string line;
+        REQUIRE(std::getline(t, line));
+        CHECK(line.find(": now expensive (") != std::string::npos);
+        REQUIRE(std::getline(t, line));
+        CHECK(line.find(": deferred 3 (") != std::string::npos);
+        REQUIRE(std::getline(t, line));
+        CHECK(line.find(": failing cannot render the message: no value (") != std::string::npos);
+        REQUIRE(std::getline(t, line));
+        CHECK(line.find(": odd cannot render the message (") != std::string::npos);
+        REQUIRE(std::getline(t, line));
+        CHECK(line.find(": widget 7 (") != std::string::npos);
+        CHECK_FALSE(std::getline(t, line));
+    }
+    std::remove(testFile.c_str());
+}
+
+namespace
+{
+
+struct SourceWidget
+{
+    void method(MultiLogger::Logger& log_) const
+    {
+        MRLogInfoL(log_, "member");
+    }
+};
+
+}
+
+TEST_CASE("Source file names", "[source-file]")
+{
+    static_assert(MultiLogger::imp::baseName("/home/build/src/app/main.cpp")[0] == 'm', "base name");
+    static_assert(MultiLogger::imp::baseName("C:\\build\\app\\x.cpp")[0] == 'x', "windows base name");
+    static_assert(MultiLogger::imp::baseName("x.cpp")[0] == 'x', "no directory");
+    static_assert(MultiLogger::imp::relativePath("/home/build/src/app/main.cpp", "/home/build/src")[0] == 'a', "relative");
+    static_assert(MultiLogger::imp::relativePath("/opt/main.cpp", "/home/build/src")[1] == 'o', "outside of the root");
+    static_assert(MultiLogger::imp::functionName("ns::Class<a::b>::method")[0] == 'C', "class scope");
+    static_assert(MultiLogger::imp::functionName("method")[0] == 'm', "no scope");
+    static_assert(MultiLogger::imp::functionName("ns::Class<a::b>::method", MULTILOGGER_FUNCTION_NAME)[0] == 'm', "scopes");
+    static_assert(MultiLogger::imp::functionName("`anonymous-namespace'::f", MULTILOGGER_FUNCTION_NAME)[0] == 'f', "anonymous scope");
+    static_assert(MultiLogger::imp::functionName("ns::Class::method", MULTILOGGER_FUNCTION_FULL)[0] == 'n', "full");
+
+    std::string category{"source"};
+    std::string testFile{"test25.log"};
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Info, category};
+        log.addDest(testFile, MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(testFile));
+        MRLogInfoL(log, "where");
+        SourceWidget{}.method(log);
+    }
+    {
+        std::ifstream t(testFile);
+        std::string line;
+        REQUIRE(std::getline(t, line));
+        CHECK(line.find("where (unittest.cpp:") != std::string::npos);
+        CHECK(line.find("CatchUnitTests") == std::string::npos);
+        REQUIRE(std::getline(t, line));
+#ifdef _MSC_VER
+        // __FUNCTION__ has the class, which the line keeps
+        CHECK(line.find(" SourceWidget::method Info: member (") != std::string::npos);
+#else
+        CHECK(line.find(" method Info: member (") != std::string::npos);
+#endif
+    }
+    std::remove(testFile.c_str());
+}
+
+TEST_CASE("Thread names", "[thread-names]")
+{
+    std::string category{"threads"};
+    std::string testFile{"test26.log"};
+    const auto threadOf = [&category](const std::string& line_) {
+        const auto categoryAt = line_.find(" " + category + " ");
+        REQUIRE(categoryAt != std::string::npos);
+        const auto index = line_.rfind(' ', categoryAt - 1) + 1;
+        return line_.substr(index, categoryAt - index);
+    };
+    const auto isIndex = [](const std::string& thread_) {
+        return !thread_.empty() && thread_.size() <= 5
+            && thread_.find_first_not_of("0123456789") == std::string::npos;
+    };
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Info, category};
+        log.addDest(testFile, MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(testFile));
+        // the backend renders nothing until the threads below are done
+        std::promise<void> release;
+        const auto released = release.get_future().share();
+        MRLogDeferredL(log, MultiLogger::Priority::Info, "held" << MultiLogger::lazy([released]() {
+            released.wait();
+            return "";
+        }));
+        std::thread{[&log]() {
+            MultiLogger::setThreadName("worker");
+            MRLogInfoL(log, "named");
+        }}.join();
+        std::thread{[&log]() {
+            MRLogInfoL(log, "unnamed");
+            MultiLogger::setThreadName("renamed");
+            MRLogInfoL(log, "renamed");
+        }}.join();
+        // looking up a thread which never logged does not register it
+        const auto unknown = MultiLogger::ThreadRegistry::instance().find(std::thread::id{});
+        CHECK(unknown._index == MultiLogger::ThreadRegistry::unknown);
+        CHECK(*unknown._text == "?");
+        log(std::string{"foreign"}, MultiLogger::Priority::Info, __FUNCTION__, __FILE__, __LINE__, std::thread::id{});
+        CHECK(MultiLogger::ThreadRegistry::instance().find(std::thread::id{})._index == MultiLogger::ThreadRegistry::unknown);
+        release.set_value();
+    }
+    {
+        std::ifstream t(testFile);
+        std::string line;
+        REQUIRE(std::getline(t, line));
+        CHECK(line.find("held") != std::string::npos);
+        // the lines show the threads as they were when logging
+        REQUIRE(std::getline(t, line));
+        CHECK(line.find(" worker threads ") != std::string::npos);
+        CHECK(line.find("Info: named ") != std::string::npos);
+        REQUIRE(std::getline(t, line));
+        CHECK(line.find("unnamed") != std::string::npos);
+        CHECK(isIndex(threadOf(line)));
+        REQUIRE(std::getline(t, line));
+        CHECK(line.find(" renamed threads ") != std::string::npos);
+        CHECK(line.find("Info: renamed ") != std::string::npos);
+        REQUIRE(std::getline(t, line));
+        CHECK(line.find(" ? threads ") != std::string::npos);
+        CHECK(line.find("Info: foreign ") != std::string::npos);
+    }
+    std::remove(testFile.c_str());
+}
+
+TEST_CASE("Line layout", "[layout]")
+{
+    std::string category{"layout"};
+    std::string testFile{"test27.log"};
+    auto json = std::make_shared<ViewDest>();
+    json->layout(MultiLogger::Layout::json);
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Debug, category};
+        log.addDest(testFile, MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(testFile));
+        log.addDest("json", json);
+        MRLogCriticalL(log, "first");
+        log.flush();
+        log.category("re\"named");
+        MRLogDebugL(log, "second");
+    }
+    {
+        std::ifstream t(testFile);
+        std::string line;
+        const std::string time{"[A-Z][a-z]{2} [ 1-3][0-9] [0-2][0-9]:[0-5][0-9]:[0-6][0-9]\\.[0-9]+ [0-9]+ "};
+        REQUIRE(std::getline(t, line));
+        CHECK(std::regex_match(line, std::regex{time + "layout [^ ]+ Critical: first \\(unittest\\.cpp:[0-9]+\\)"}));
+        REQUIRE(std::getline(t, line));
+        CHECK(std::regex_match(line, std::regex{time + "re\"named [^ ]+ Debug: second \\(unittest\\.cpp:[0-9]+\\)"}));
+    }
+    REQUIRE(json->_lines.size() == 2);
+    CHECK_THAT(json->_lines[0], Catch::Matchers::Contains(",\"priority\":\"Critical\",\"category\":\"layout\",\"thread\":\""));
+    CHECK_THAT(json->_lines[1], Catch::Matchers::Contains(",\"priority\":\"Debug\",\"category\":\"re\\\"named\",\"thread\":\""));
+    std::remove(testFile.c_str());
+}
+
+TEST_CASE("Pattern layouts", "[pattern-layout]")
+{
+    const std::string terseFile{"test28.log"};
+    const std::string customFile{"test29.log"};
+    auto terse = std::make_shared<MultiLogger::FileDest>(terseFile);
+    auto custom = std::make_shared<MultiLogger::FileDest>(customFile);
+    auto sameAsTerse = std::make_shared<MultiLogger::CountingDest>(true);
+    CHECK(terse->layout() == MultiLogger::Layout::classic);
+    terse->layout("%p: %m");
+    custom->layout("[%c] %m %% %L");
+    sameAsTerse->layout("%p: %m");
+    CHECK(terse->layout() == "%p: %m");
+    CHECK_THROWS_AS(custom->layout("%m %x"), std::runtime_error);
+    CHECK_THROWS_AS(custom->layout("%m %"), std::runtime_error);
+    CHECK(custom->layout() == "[%c] %m %% %L");
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Debug, "pattern"};
+        log.addDest(terseFile, terse);
+        log.addDest(customFile, custom);
+        log.addDest("same as terse", sameAsTerse);
+        MRLogWarningL(log, "first");
+        MRLogInfoL(log, "second " << 2);
+    }
+    {
+        std::ifstream t(terseFile);
+        std::string line;
+        REQUIRE(std::getline(t, line));
+        CHECK(line == "Warning: first");
+        REQUIRE(std::getline(t, line));
+        CHECK(line == "Info: second 2");
+        CHECK_FALSE(std::getline(t, line));
+    }
+    {
+        std::ifstream t(customFile);
+        std::string line;
+        REQUIRE(std::getline(t, line));
+        CHECK(std::regex_match(line, std::regex{"\\[pattern\\] first % [0-9]+"}));
+        REQUIRE(std::getline(t, line));
+        CHECK(std::regex_match(line, std::regex{"\\[pattern\\] second 2 % [0-9]+"}));
+    }
+    CHECK(sameAsTerse->lines() == 2);
+    CHECK(sameAsTerse->bytes() == std::string{"Warning: first\nInfo: second 2\n"}.size());
+    std::remove(terseFile.c_str());
+    std::remove(customFile.c_str());
+}
+
+
+TEST_CASE("Shared rendering", "[shared-rendering]")
+{
+    auto first = std::make_shared<ViewDest>();
+    auto second = std::make_shared<ViewDest>();
+    auto terse = std::make_shared<ViewDest>();
+    auto errors = std::make_shared<ViewDest>();
+    terse->layout("%p: %m");
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Debug, "shared"};
+        log.addDest("first", first);
+        log.addDest("second", second);
+        log.addDest("terse", terse);
+        log.addDest("errors", MultiLogger::Priority::Error, errors);
+        MRLogInfoL(log, "info");
+        MRLogErrorL(log, "error");
+        log.flush();
+    }
+    REQUIRE(first->_views.size() == 2);
+    // the destinations of the same layout get the same bytes
+    CHECK(second->_views == first->_views);
+    REQUIRE(errors->_views.size() == 1);
+    CHECK(errors->_views[0] == first->_views[1]);
+    REQUIRE(terse->_lines.size() == 2);
+    CHECK(terse->_views[0] != first->_views[0]);
+    CHECK(terse->_lines[0] == "Info: info\n");
+    CHECK(terse->_lines[1] == "Error: error\n");
+}
+
+TEST_CASE("Structured fields", "[fields]")
+{
+    const std::string textFile{"test30.log"};
+    const std::string jsonFile{"test31.log"};
+    const std::string name{"alice"};
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Debug, "fields"};
+        log.addDest(textFile, MultiLogger::cpp14::imp::make_unique<MultiLogger::FileDest>(textFile));
+        log.addDest(jsonFile, MultiLogger::cpp14::imp::make_unique<MultiLogger::JsonFileDest>(jsonFile));
+        MRLogInfoL(log, "login" << MultiLogger::kv("user", name) << MultiLogger::kv("age", 42)
+            << MultiLogger::kv("count", 7u) << MultiLogger::kv("delta", -3) << MultiLogger::kv("admin", true)
+            << MultiLogger::kv("ratio", 0.5) << MultiLogger::kv("quote", "tab\there \"q\""));
+        MRLogWarningL(log, "0123456789abcdef\"\\\x01" << MultiLogger::kv("missing", std::nan("")));
+    }
+    {
+        std::ifstream t(textFile);
+        std::string line;
+        REQUIRE(std::getline(t, line));
+        CHECK_THAT(line, Catch::Matchers::Contains(
+            " Info: login user=alice age=42 count=7 delta=-3 admin=true ratio=0.5 quote=tab\there \"q\" (unittest.cpp:"));
+    }
+    {
+        std::ifstream t(jsonFile);
+        std::string line;
+        REQUIRE(std::getline(t, line));
+        const std::string head{"\\{\"time\":\"[0-9]{4}-[0-9]{2}-[0-9]{2}T[0-9]{2}:[0-9]{2}:[0-9]{2}\\.[0-9]{9}Z\""};
+        CHECK(std::regex_match(line, std::regex{head + ",\"priority\":\"Info\",\"category\":\"fields\",\"thread\":\"[^\"]+\""
+            ",\"function\":\"[^\"]+\",\"file\":\"unittest\\.cpp\",\"line\":[0-9]+,\"message\":\"login\".*"}));
+        CHECK_THAT(line, Catch::Matchers::EndsWith(
+            ",\"user\":\"alice\",\"age\":42,\"count\":7,\"delta\":-3,\"admin\":true,\"ratio\":0.5,\"quote\":\"tab\\there \\\"q\\\"\"}"));
+        REQUIRE(std::getline(t, line));
+        CHECK_THAT(line, Catch::Matchers::EndsWith(
+            ",\"message\":\"0123456789abcdef\\\"\\\\\\u0001\",\"missing\":null}"));
+        CHECK_FALSE(std::getline(t, line));
+    }
+    std::ostringstream plain;
+    plain << MultiLogger::kv("user", name);
+    CHECK(plain.str() == "user=alice");
+    std::remove(textFile.c_str());
+    std::remove(jsonFile.c_str());
+}
+
+namespace
+{
+
+/// Checks the syntax of compact JSON, as the JSON lines are written.
+class JsonChecker
+{
+public:
+    /// @return true if text_ is a JSON object
+    static bool isObject(const std::string& text_)
+    {
+        JsonChecker checker{text_};
+        return (checker.peek() == '{') && checker.value() && (checker._at == text_.size());
+    }
+
+private:
+    explicit JsonChecker(const std::string& text_)
+        : _text(text_)
+    {}
+
+    char peek() const
+    {
+        return (_at < _text.size()) ? _text[_at] : '\0';
+    }
+
+    bool take(const char c_)
+    {
+        if (peek() != c_) {
+            return false;
+        }
+        ++_at;
+        return true;
+    }
+
+    bool value()
+    {
+        switch (peek()) {
+            case '{': return members('}', true);
+            case '[': return members(']', false);
+            case '"': return string();
+            case 't': return word("true");
+            case 'f': return word("false");
+            case 'n': return word("null");
+            default: return number();
+        }
+    }
+
+    bool members(const char close_, const bool keys_)
+    {
+        ++_at;
+        if (take(close_)) {
+            return true;
+        }
+        do {
+            if ((keys_ && !(string() && take(':'))) || !value()) {
+                return false;
+            }
+        } while (take(','));
+        return take(close_);
+    }
+
+    bool string()
+    {
+        if (!take('"')) {
+            return false;
+        }
+        while (_at < _text.size()) {
+            const auto c = static_cast<unsigned char>(_text[_at++]);
+            if (c == '"') {
+                return true;
+            }
+            if (c < 0x20) {
+                return false;
+            }
+            if (c == '\\') {
+                const auto escaped = peek();
+                ++_at;
+                if (escaped == 'u') {
+                    for (auto i = 0; i < 4; ++i) {
+                        if (!std::isxdigit(static_cast<unsigned char>(peek()))) {
+                            return false;
+                        }
+                        ++_at;
+                    }
+                } else if ((escaped == '\0') || (std::strchr("\"\\/bfnrt", escaped) == nullptr)) {
+                    return false;
+                }
+            }
+        }
+        return false;
+    }
+
+    bool word(const char* word_)
+    {
+        const auto size = std::strlen(word_);
+        if (_text.compare(_at, size, word_) != 0) {
+            return false;
+        }
+        _at += size;
+        return true;
+    }
+
+    bool number()
+    {
+        static const std::regex pattern{"-?(0|[1-9][0-9]*)(\\.[0-9]+)?([eE][+-]?[0-9]+)?"};
+        std::smatch match;
+        if (!std::regex_search(_text.begin() + static_cast<std::ptrdiff_t>(_at), _text.end(), match, pattern
+            , std::regex_constants::match_continuous)) {
+            return false;
+        }
+        _at += static_cast<size_t>(match.length());
+        return true;
+    }
+
+    const std::string&  _text;
+    size_t              _at{0};
+};
+
+}
+
+TEST_CASE("JSON lines", "[json]")
+{
+    const std::string jsonFile{"test32.log"};
+    const std::string terseFile{"test33.log"};
+    auto json = std::make_shared<MultiLogger::JsonFileDest>(jsonFile);
+    auto terse = std::make_shared<MultiLogger::JsonFileDest>(terseFile);
+    terse->layout("%p: %m");
+    json->write(std::string{"written \"directly\"\n"});
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Debug, "json \"lines\""};
+        log.addDest(jsonFile, json);
+        log.addDest(terseFile, terse);
+        // the layouts set after adding the destinations do not apply
+        json->layout("%p: %m");
+        terse->layout(MultiLogger::Layout::json);
+        log.dedup(jsonFile, std::chrono::milliseconds{60 * 1000});
+        for (auto i = 0; i < 5; ++i) {
+            MRLogInfoL(log, "the \"same\"" << MultiLogger::kv("ratio", 0.25) << MultiLogger::kv("admin", false));
+        }
+        MRLogWarningL(log, "another\tline\n");
+    }
+    const auto linesOf = [](const std::string& file_) {
+        std::vector<std::string> lines;
+        std::ifstream t(file_);
+        for (std::string line; std::getline(t, line); ) {
+            lines.push_back(line);
+        }
+        return lines;
+    };
+    const auto jsonLines = linesOf(jsonFile);
+    REQUIRE(jsonLines.size() == 4);
+    for (const auto& line : jsonLines) {
+        CHECK(JsonChecker::isObject(line));
+    }
+    CHECK(jsonLines[0] == "{\"message\":\"written \\\"directly\\\"\"}");
+    CHECK_THAT(jsonLines[1], Catch::Matchers::Contains(",\"message\":\"the \\\"same\\\"\",\"ratio\":0.25,\"admin\":false}"));
+    CHECK_THAT(jsonLines[2], Catch::Matchers::Contains("\"priority\":\"Info\",\"category\":\"json \\\"lines\\\"\""));
+    CHECK_THAT(jsonLines[2], Catch::Matchers::Contains(",\"message\":\"last message repeated 4 times\"}"));
+    CHECK_THAT(jsonLines[3], Catch::Matchers::Contains(",\"message\":\"another\\tline\\n\"}"));
+    const auto terseLines = linesOf(terseFile);
+    REQUIRE(terseLines.size() == 6);
+    for (const auto& line : terseLines) {
+        CHECK(JsonChecker::isObject(line));
+    }
+    CHECK(terseLines[0] == "{\"message\":\"Info: the \\\"same\\\" ratio=0.25 admin=false\"}");
+    CHECK(terseLines[5] == "{\"message\":\"Warning: another\\tline\\n\"}");
+    CHECK_FALSE(JsonChecker::isObject("{\"message\":\"open\"} {}"));
+    CHECK_FALSE(JsonChecker::isObject("Info: the same"));
+    std::remove(jsonFile.c_str());
+    std::remove(terseFile.c_str());
+}
+
+TEST_CASE("Mapped diagnostic context", "[context]")
+{
+    auto text = std::make_shared<ViewDest>();
+    auto json = std::make_shared<ViewDest>();
+    json->layout(MultiLogger::Layout::json);
+    {
+        MultiLogger::Logger log{MultiLogger::Priority::Debug, "context"};
+        log.addDest("text", text);
+        log.addDest("json", json);
+        MRLogInfoL(log, "outside");
+        {
+            const MultiLogger::ScopedContext request{MultiLogger::kv("request", 42), MultiLogger::kv("tenant", "acme")};
+            MRLogInfoL(log, "accepted" << MultiLogger::kv("status", 200));
+            {
+                const MultiLogger::ScopedContext step{MultiLogger::kv("step", "parse")};
+                MRLogInfoL(log, "parsing");
+                // a thread id which never logged shares the cached rendering of the unknown threads
+                log(std::string{"foreign step"}, MultiLogger::Priority::Info, __FUNCTION__, __FILE__, __LINE__, std::thread::id{});
+            }
+            MRLogInfoL(log, "done");
+            log(std::string{"foreign done"}, MultiLogger::Priority::Info, __FUNCTION__, __FILE__, __LINE__, std::thread::id{});
+            std::thread{[&log]() {
+                MRLogInfoL(log, "other");
+            }}.join();
+        }
+        MRLogInfoL(log, "after");
+        log.flush();
+    }
+    REQUIRE(text->_lines.size() == 8);
+    CHECK_THAT(text->_lines[0], Catch::Matchers::Contains(" Info: outside ("));
+    CHECK_THAT(text->_lines[1], Catch::Matchers::Contains(" Info: accepted request=42 tenant=acme status=200 ("));
+    CHECK_THAT(text->_lines[2], Catch::Matchers::Contains(" Info: parsing request=42 tenant=acme step=parse ("));
+    CHECK_THAT(text->_lines[3], Catch::Matchers::Contains(" ? context "));
+    CHECK_THAT(text->_lines[3], Catch::Matchers::Contains(" Info: foreign step request=42 tenant=acme step=parse ("));
+    CHECK_THAT(text->_lines[4], Catch::Matchers::Contains(" Info: done request=42 tenant=acme ("));
+    CHECK_THAT(text->_lines[5], Catch::Matchers::Contains(" Info: foreign done request=42 tenant=acme ("));
+    CHECK_THAT(text->_lines[6], Catch::Matchers::Contains(" Info: other ("));
+    CHECK_THAT(text->_lines[7], Catch::Matchers::Contains(" Info: after ("));
+    REQUIRE(json->_lines.size() == 8);
+    CHECK_THAT(json->_lines[0], Catch::Matchers::EndsWith(",\"message\":\"outside\"}\n"));
+    CHECK_THAT(json->_lines[1], Catch::Matchers::EndsWith(
+        ",\"message\":\"accepted\",\"request\":42,\"tenant\":\"acme\",\"status\":200}\n"));
+    CHECK_THAT(json->_lines[2], Catch::Matchers::EndsWith(
+        ",\"message\":\"parsing\",\"request\":42,\"tenant\":\"acme\",\"step\":\"parse\"}\n"));
+
+    // the threads in the same context share its snapshot
+    const MultiLogger::imp::Context* shared = nullptr;
+    {
+        const MultiLogger::ScopedContext tenant{MultiLogger::kv("tenant", "acme")};
+        std::thread{[&shared]() {
+            const MultiLogger::ScopedContext same{MultiLogger::kv("tenant", "acme")};
+            shared = MultiLogger::currentContext();
+        }}.join();
+        CHECK(shared == MultiLogger::currentContext());
+    }
+    CHECK(MultiLogger::currentContext() == nullptr);
+}